@@ -170,5 +170,8 @@ int main()
 	oak::primary_render_loop(device, resources, window, render, resize);
 
 	device.waitIdle();
+	device.savePipelineCache();
+	device.pipeline_registry->destroy();
+	device.pipeline_cache->destroy();
 	window.destroy(device);
 }
@@ -1,3 +1,4 @@
+#include <fstream>
 #include <stack>
 
 #include <oak.hpp>
@@ -114,7 +115,7 @@ int main(int argc, char *argv[])
 			.with_format(vk::Format::eD32Sfloat)
 			.with_samples(vk::SampleCountFlagBits::e1)
 			.with_load_operation(vk::AttachmentLoadOp::eClear)
-			.with_store_operation(vk::AttachmentStoreOp::eStore)
+			.with_store_operation(vk::AttachmentStoreOp::eDontCare)
 			.done()
 		.add_reference_collection()
 			.with_reference(0, vk::ImageLayout::eColorAttachmentOptimal)
@@ -132,7 +133,8 @@ int main(int argc, char *argv[])
 		.with_format(vk::Format::eD32Sfloat)
 		.with_size(window.extent())
 		.with_usage(vk::ImageUsageFlagBits::eDepthStencilAttachment)
-		.with_aspect(vk::ImageAspectFlagBits::eDepth);
+		.with_aspect(vk::ImageAspectFlagBits::eDepth)
+		.with_transient(true);
 
 	auto db = oak::Image::from(device, db_config);
 
@@ -173,13 +175,18 @@ int main(int argc, char *argv[])
 		.with_fragment(fragment)
 		.with_attachments(false)
 		.with_depth_test(true)
-		.with_depth_write(true);
+		.with_depth_write(true)
+		.with_dynamic(oak::RasterDynamicState { .fill = true });
 
 	auto pipeline = compile_pipeline(device, render_pass, config);
 
-	// Allocate mesh buffers
-	auto vb = oak::Buffer::from(device, mesh.vertices, vk::BufferUsageFlagBits::eVertexBuffer);
-	auto ib = oak::Buffer::from(device, mesh.indices, vk::BufferUsageFlagBits::eIndexBuffer);
+	// Allocate mesh buffers in device local memory
+	oak::StagingUploader uploader(device, resources);
+
+	auto vb = uploader.upload(mesh.vertices, vk::BufferUsageFlagBits::eVertexBuffer);
+	auto ib = uploader.upload(mesh.indices, vk::BufferUsageFlagBits::eIndexBuffer);
+
+	uploader.flush();
 
 	// Prepare camera and model matrices
 	glm::mat4 model = glm::mat4 { 1.0f };
@@ -196,12 +203,31 @@ int main(int argc, char *argv[])
 	bool pause_rotate = false;
 	bool pause_resume_pressed = false;
 
+	bool wireframe = false;
+	bool wireframe_pressed = false;
+
+	// Screenshots are copied into a host cached ring partitioned per
+	// frame in flight, and written out once their frame has retired
+	auto readback = oak::ReadbackRing::from(device,
+		window.images.size(),
+		oak::Image::bytes(window.format, window.extent()));
+
+	bool screenshot_pressed = false;
+	bool capture = false;
+
+	std::optional <oak::Readback> screenshot;
+	vk::Extent2D screenshot_extent;
+
 	float previous_time = 0.0f;
 	float current_time = 0.0f;
 
 	fmt::println("\nInstructions:");
 	fmt::println("[ +/- ] Zoom in/out");
 	fmt::println("[Space] Pause/resume rotation");
+	fmt::println("[  P  ] Save a screenshot");
+
+	if (pipeline.dynamic.fill)
+		fmt::println("[  W  ] Toggle wireframe");
 
 	auto render = [&](const vk::CommandBuffer &cmd, uint32_t image_index) {
                	auto &framebuffer = framebuffers[image_index];
@@ -238,6 +264,24 @@ int main(int argc, char *argv[])
 			pause_resume_pressed = false;
 		}
 
+		// Toggle wireframe, without another pipeline
+		if (glfwGetKey(window.glfw, GLFW_KEY_W) == GLFW_PRESS) {
+			if (!wireframe_pressed) {
+				wireframe = !wireframe;
+				wireframe_pressed = true;
+			}
+		} else {
+			wireframe_pressed = false;
+		}
+
+		// Screenshot, one at a time
+		if (glfwGetKey(window.glfw, GLFW_KEY_P) == GLFW_PRESS) {
+			capture = !screenshot_pressed && !screenshot;
+			screenshot_pressed = true;
+		} else {
+			screenshot_pressed = false;
+		}
+
 		if (!pause_rotate)
 			current_time += glfwGetTime() - previous_time;
 
@@ -295,20 +339,102 @@ int main(int argc, char *argv[])
 		push_constants.light_direction = glm::normalize(glm::vec3 { 0, 0, 1 });
 
 		cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline.handle);
+
+		if (pipeline.dynamic.fill)
+			pipeline.setPolygonMode(cmd, wireframe ? vk::PolygonMode::eLine : vk::PolygonMode::eFill);
+
 		cmd.pushConstants <MVP> (pipeline.layout, vk::ShaderStageFlagBits::eVertex, 0, push_constants);
 		cmd.bindVertexBuffers(0, vb.handle, { 0 });
 		cmd.bindIndexBuffer(ib.handle, 0, vk::IndexType::eUint32);
 		cmd.drawIndexed(mesh.indices.size(), 1, 0, 0, 0);
 
         	cmd.endRenderPass();
+
+		if (capture) {
+			oak::Image image;
+			image.handle = window.images[image_index];
+			image.format = window.format;
+			image.size = window.extent();
+			image.aspect = vk::ImageAspectFlagBits::eColor;
+
+			screenshot = readback.download(cmd, image,
+				vk::ImageLayout::ePresentSrcKHR,
+				vk::PipelineStageFlagBits::eColorAttachmentOutput,
+				vk::PipelineStageFlagBits::eBottomOfPipe,
+				vk::AccessFlagBits::eColorAttachmentWrite);
+
+			screenshot_extent = image.size;
+			capture = false;
+		}
+	};
+
+	// Writes the screenshot as a binary PPM
+	auto save_screenshot = [&]() {
+		bool bgra = (window.format == vk::Format::eB8G8R8A8Unorm)
+			|| (window.format == vk::Format::eB8G8R8A8Srgb);
+
+		bool rgba = (window.format == vk::Format::eR8G8B8A8Unorm)
+			|| (window.format == vk::Format::eR8G8B8A8Srgb);
+
+		if (!bgra && !rgba) {
+			howl_warning("cannot save screenshots of {} swapchains", vk::to_string(window.format));
+			screenshot.reset();
+			return;
+		}
+
+		auto pixels = screenshot->data <uint8_t> (device);
+
+		std::ofstream file("screenshot.ppm", std::ios::binary);
+		file << "P6\n" << screenshot_extent.width << " " << screenshot_extent.height << "\n255\n";
+
+		for (size_t i = 0; i + 4 <= pixels.size(); i += 4) {
+			char rgb[3] = {
+				char(pixels[i + (bgra ? 2 : 0)]),
+				char(pixels[i + 1]),
+				char(pixels[i + (bgra ? 0 : 2)]),
+			};
+
+			file.write(rgb, 3);
+		}
+
+		howl_info("saved screenshot.ppm ({}x{})", screenshot_extent.width, screenshot_extent.height);
+
+		screenshot.reset();
+	};
+
+	// Written without stalling, once the frame has completed
+	auto after_present = [&]() {
+		if (screenshot && screenshot->ready(device))
+			save_screenshot();
 	};
 
 	auto resize = [&]() {
+		for (auto &framebuffer : framebuffers)
+			device.destroyFramebuffer(framebuffer);
+
 		framebuffers.clear();
 
+		// The device is idle, so a pending screenshot is complete; the
+		// ring is then resized for the new swapchain extent
+		if (screenshot)
+			save_screenshot();
+
+		readback.destroy(device);
+		readback = oak::ReadbackRing::from(device,
+			window.images.size(),
+			oak::Image::bytes(window.format, window.extent()));
+
+		// Depth buffer follows the swapchain extent
+		db.destroy(device);
+		db = oak::Image::from(device, db_config.with_size(window.extent()));
+
 		for (auto &view : window.views) {
+			std::array <vk::ImageView, 2> views;
+			views[0] = view;
+			views[1] = db.view;
+
 			auto fb_info = vk::FramebufferCreateInfo()
-				.setAttachments(view)
+				.setAttachments(views)
 				.setWidth(window.width)
 				.setHeight(window.height)
 				.setLayers(1)
@@ -318,9 +444,17 @@ int main(int argc, char *argv[])
 		}
 	};
 
-	oak::primary_render_loop(device, resources, window, render, resize);
+	oak::primary_render_loop(device, resources, window, render, resize, after_present, nullptr, &readback);
 
 	device.waitIdle();
+
+	if (screenshot)
+		save_screenshot();
+
+	readback.destroy(device);
+	device.savePipelineCache();
+	device.pipeline_registry->destroy();
+	device.pipeline_cache->destroy();
 	window.destroy(device);
 }
 
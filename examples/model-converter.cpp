@@ -0,0 +1,50 @@
+#include <chrono>
+#include <cstdio>
+
+// Argument parsing
+#include "argparser.hpp"
+
+// Meshes, Assimp import and the binary model container
+#include "model.hpp"
+#include "optimizer.hpp"
+
+int main(int argc, char *argv[])
+{
+	// Process the arguments
+	ArgParser argparser { "example-model-converter", 2, {
+		ArgParser::Option { "input", "Any model Assimp can import" },
+		ArgParser::Option { "output", "Converted model (.oakm)" },
+	}};
+
+	argparser.parse(argc, argv);
+
+	std::filesystem::path input = argparser.get <std::string> (0);
+	std::filesystem::path output = argparser.get <std::string> (1);
+
+	input = std::filesystem::weakly_canonical(input);
+	output = std::filesystem::weakly_canonical(output);
+
+	auto start = std::chrono::steady_clock::now();
+
+	oak::ThreadPool pool;
+
+	Model model = load_model(input, pool);
+	if (model.empty())
+		return argparser.error("no meshes imported from " + input.string());
+
+	model = optimize_model(std::move(model), pool);
+
+	// Texture paths are kept relative to the converted file
+	auto file = ModelFile::pack(model, output.parent_path());
+
+	if (!file.write(output))
+		return argparser.error("failed to write " + output.string());
+
+	auto elapsed = std::chrono::duration <double, std::milli> (std::chrono::steady_clock::now() - start);
+
+	auto &header = file.header();
+
+	printf("Converted %u meshes (%lu vertices, %lu indices, %u materials) to %s in %.1f ms\n",
+		header.mesh_count, header.vertex_count, header.index_count,
+		header.material_count, output.c_str(), elapsed.count());
+}
@@ -1,6 +1,6 @@
 #include "device-resources.hpp"
+#include <chrono>
 #include <map>
-#include <stack>
 
 #include <oak.hpp>
 
@@ -8,11 +8,6 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
-// Assimp for mesh loading
-#include <assimp/Importer.hpp>
-#include <assimp/scene.h>
-#include <assimp/postprocess.h>
-#include <assimp/material.h>
 #include <vulkan/vulkan_enums.hpp>
 #include <vulkan/vulkan_structs.hpp>
 
@@ -29,39 +24,9 @@
 // Argument parsing
 #include "argparser.hpp"
 
-// Vertex data
-struct Vertex {
-	glm::vec3 position;
-	glm::vec3 normal;
-	glm::vec2 uv;
-
-	static vk::VertexInputBindingDescription binding() {
-		return vk::VertexInputBindingDescription()
-			.setBinding(0)
-			.setInputRate(vk::VertexInputRate::eVertex)
-			.setStride(sizeof(Vertex));
-	}
-
-	static std::vector <vk::VertexInputAttributeDescription> attributes() {
-		return {
-			vk::VertexInputAttributeDescription()
-				.setBinding(0)
-				.setFormat(vk::Format::eR32G32B32Sfloat)
-				.setLocation(0)
-				.setOffset(offsetof(Vertex, position)),
-			vk::VertexInputAttributeDescription()
-				.setBinding(0)
-				.setFormat(vk::Format::eR32G32B32Sfloat)
-				.setLocation(1)
-				.setOffset(offsetof(Vertex, normal)),
-			vk::VertexInputAttributeDescription()
-				.setBinding(0)
-				.setFormat(vk::Format::eR32G32Sfloat)
-				.setLocation(2)
-				.setOffset(offsetof(Vertex, uv)),
-		};
-	}
-};
+// Meshes, Assimp import and the binary model container
+#include "model.hpp"
+#include "optimizer.hpp"
 
 // View and lighting information
 struct MVP {
@@ -73,35 +38,29 @@ struct MVP {
 	alignas(16) glm::vec3 albedo_color;
 };
 
-// Mesh and mesh loading
-struct Mesh {
-	std::vector <Vertex> vertices;
-	std::vector <uint32_t> indices;
-
-	std::filesystem::path albedo_path;
-
-	glm::vec3 albedo_color = glm::vec3(1.0f);
-};
-
-using Model = std::vector <Mesh>;
-
-Model load_model(const std::filesystem::path &);
-
-// Translating CPU data to Vulkan resources
+// Translating CPU data to Vulkan resources; each mesh is sub-allocated
+// from the geometry pool shared by the whole model
 struct VulkanMesh {
-	oak::Buffer vertex_buffer;
-	oak::Buffer index_buffer;
-	size_t index_count;
+	oak::GeometryPool::Geometry geometry;
+	uint32_t material;
 
-	oak::Image albedo_image;
-	vk::Sampler albedo_sampler;
+	oak::TextureLoader::Handle albedo;
 	bool has_texture;
 
+	// Bounding sphere, for the texture's screen coverage
+	glm::vec3 center;
+	float radius;
+
 	glm::vec3 albedo_color;
 
-	vk::DescriptorSet descriptor;
+	// One set per frame in flight, since a set cannot be rewritten
+	// while a pending submission uses it; bound records the view each
+	// one was last written with
+	std::vector <vk::DescriptorSet> descriptors;
+	std::vector <vk::ImageView> bound;
 
-	static VulkanMesh from(const oak::Device &, const oak::DeviceResources &, const Mesh &);
+	static VulkanMesh from(oak::TextureLoader &, oak::StagingUploader &, oak::GeometryPool &,
+			       const ModelFile &, const ModelFile::Range &, const std::filesystem::path &);
 };
 
 // Mouse control
@@ -126,94 +85,91 @@ void mouse_callback(GLFWwindow *, int, int, int);
 void cursor_callback(GLFWwindow *, double, double);
 void scroll_callback(GLFWwindow *, double, double);
 
-std::optional <oak::Image> load_texture(const oak::Device &device, const oak::DeviceResources &resources, const std::filesystem::path &path)
+// KTX2 textures are looked for next to the source images
+std::filesystem::path ktx2_path(const std::filesystem::path &path)
 {
-	static std::map <std::string, oak::Image> cache;
-
-	if (cache.count(path.string()))
-		return cache.at(path.string());
+	auto result = path;
+	result.replace_extension(".ktx2");
+	return result;
+}
 
+// Runs on the loader's worker threads
+std::optional <oak::Texture> decode_image(const std::vector <uint8_t> &bytes)
+{
 	int width;
 	int height;
 	int channels;
 
-	uint8_t *pixels = stbi_load(path.c_str(), &width, &height, &channels, 4);
+	uint8_t *pixels = stbi_load_from_memory(bytes.data(), bytes.size(), &width, &height, &channels, 4);
 	if (!pixels)
 		return std::nullopt;
 
-	// TODO: builder pattern
-	auto info = oak::ImageInfo()
-		.with_format(vk::Format::eR8G8B8A8Unorm)
-		.with_size(vk::Extent2D(width, height))
-		.with_usage(vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst)
-		.with_aspect(vk::ImageAspectFlagBits::eColor);
+	// Mips are generated when the loader uploads it
+	oak::Texture result;
+	result.width = width;
+	result.height = height;
+	result.format = vk::Format::eR8G8B8A8Unorm;
+	result.data.resize(4 * width * height);
 
-	auto result = oak::Image::from(device, info);
-	cache.emplace(path.string(), result);
+	std::memcpy(result.data.data(), pixels, result.data.size());
 
-	// Transfer image data
-	oak::Texture loaded;
-	loaded.width = width;
-	loaded.height = height;
-	loaded.data.resize(4 * width * height);
-	loaded.format = info.format;
-
-	std::memcpy(loaded.data.data(), pixels, loaded.data.size());
-
-	// Transfer to Vulkan image
-	auto alloc_info = vk::CommandBufferAllocateInfo()
-		.setCommandPool(resources.command_pool)
-		.setCommandBufferCount(1);
-
-	auto cmd = device.allocateCommandBuffers(alloc_info).front();
-
-	cmd.begin(vk::CommandBufferBeginInfo());
-	{
-		result.transitionary_upload(device, cmd, loaded);
-	}
-	cmd.end();
-
-	resources.queue.submitAndWait({ cmd });
-
-	// Release resources
 	stbi_image_free(pixels);
 
 	return result;
 }
 
-VulkanMesh VulkanMesh::from(const oak::Device &device, const oak::DeviceResources &resources, const Mesh &mesh)
+VulkanMesh VulkanMesh::from(oak::TextureLoader &loader,
+			    oak::StagingUploader &uploader,
+			    oak::GeometryPool &geometry_pool,
+			    const ModelFile &file,
+			    const ModelFile::Range &range,
+			    const std::filesystem::path &directory)
 {
 	// Create the Vulkan mesh
 	VulkanMesh vk_mesh;
 
-	vk_mesh.index_count = mesh.indices.size();
+	// Streams are staged straight from the file
+	auto index_type = (range.index_size == sizeof(uint16_t))
+		? vk::IndexType::eUint16
+		: vk::IndexType::eUint32;
+
+	auto geometry = geometry_pool.add(uploader,
+		file.vertices().data() + range.first_vertex, range.vertex_count,
+		file.indices().data() + size_t(range.first_index) * range.index_size, range.index_count,
+		index_type);
+
+	howl_assert(geometry, "geometry pool is sized for the whole model");
+
+	vk_mesh.geometry = geometry.value();
+	vk_mesh.material = range.material;
 	vk_mesh.has_texture = false;
 
-	// Buffers
-	vk_mesh.vertex_buffer = oak::Buffer::from(device, mesh.vertices, vk::BufferUsageFlagBits::eVertexBuffer);
-	vk_mesh.index_buffer = oak::Buffer::from(device, mesh.indices, vk::BufferUsageFlagBits::eIndexBuffer);
-
-	// Albedo
-	if (!mesh.albedo_path.empty()) {
-		auto image = load_texture(device, resources, mesh.albedo_path);
-
-		if (image.has_value()) {
-			auto info = vk::SamplerCreateInfo()
-				.setMaxLod(1)
-				.setMinLod(1)
-				.setMagFilter(vk::Filter::eLinear)
-				.setMinFilter(vk::Filter::eLinear);
-
-			vk_mesh.albedo_image = image.value();
-			vk_mesh.albedo_sampler = device.createSampler(info);
-			vk_mesh.has_texture = true;
-		} else {
-			howl_error("failed to load albedo texture {}", mesh.albedo_path.c_str());
-		}
+	glm::vec3 min { range.min[0], range.min[1], range.min[2] };
+	glm::vec3 max { range.max[0], range.max[1], range.max[2] };
+
+	vk_mesh.center = 0.5f * (min + max);
+	vk_mesh.radius = 0.5f * glm::length(max - min);
+
+	auto &material = file.materials()[range.material];
+
+	// Albedo, sampled from a placeholder until it is loaded
+	if (material.albedo_path != ModelFile::none) {
+		auto albedo_path = directory / file.string(material.albedo_path);
+
+		auto path = ktx2_path(albedo_path);
+		if (!oak::KTX2::valid(path))
+			path = albedo_path;
+
+		vk_mesh.albedo = loader.request(path);
+		vk_mesh.has_texture = true;
 	}
 
 	// Other material properties
-	vk_mesh.albedo_color = glm::vec4(mesh.albedo_color, 1.0f);
+	vk_mesh.albedo_color = glm::vec3 {
+		material.albedo_color[0],
+		material.albedo_color[1],
+		material.albedo_color[2]
+	};
 
 	return vk_mesh;
 }
@@ -223,6 +179,7 @@ int main(int argc, char *argv[])
 	// Process the arguments
 	ArgParser argparser { "example-model-viewer", 1, {
 		ArgParser::Option { "filename", "Input model" },
+		ArgParser::Option { { "-b", "--texture-budget" }, "Texture memory budget in MiB", true },
 	}};
 
 	argparser.parse(argc, argv);
@@ -231,27 +188,43 @@ int main(int argc, char *argv[])
 	path = argparser.get <std::string> (0);
 	path = std::filesystem::weakly_canonical(path);
 
-	// Load the mesh
-	Model model = load_model(path);
+	// In MiB, so it must stay representable once shifted into bytes
+	size_t texture_budget = 512;
+	try {
+		long int budget = argparser.get_optn <long int> ("--texture-budget");
+		if (budget <= 0 || uint64_t(budget) > (SIZE_MAX >> 20))
+			return argparser.error("texture budget must be between 1 and " + std::to_string(SIZE_MAX >> 20) + " MiB");
 
-	fmt::println("Loaded model with %lu meshes", model.size());
+		texture_budget = budget;
+	} catch (const ArgParser::optn_null_value &) {}
 
-	// Precompute some data for rendering
-	glm::vec3 center = glm::vec3(0.0f);
-	glm::vec3 min = glm::vec3(FLT_MAX);
-	glm::vec3 max = glm::vec3(-FLT_MAX);
-
-	float count = 0.0f;
-	for (const auto &mesh : model) {
-		for (const Vertex &vertex : mesh.vertices) {
-			center += vertex.position;
-			min = glm::min(min, vertex.position);
-			max = glm::max(max, vertex.position);
-			count++;
-		}
+	// Converted models are mapped and used in place, anything
+	// else is imported and packed into the same layout in memory
+	auto start = std::chrono::steady_clock::now();
+
+	// Shared by the import and, later on, by texture decoding
+	oak::ThreadPool pool;
+
+	std::optional <ModelFile> file;
+	if (path.extension() == ".oakm")
+		file = ModelFile::map(path);
+	else
+		file = ModelFile::pack(optimize_model(load_model(path, pool), pool), path.parent_path());
+
+	if (!file.has_value() || file->header().mesh_count == 0) {
+		fprintf(stderr, "Failed to load model %s\n", path.c_str());
+		return -1;
 	}
 
-	center /= count;
+	auto elapsed = std::chrono::duration <double, std::milli> (std::chrono::steady_clock::now() - start);
+
+	fmt::println("Loaded model with {} meshes in {:.1f} ms", file->header().mesh_count, elapsed.count());
+
+	// Precompute some data for rendering
+	glm::vec3 min { file->header().min[0], file->header().min[1], file->header().min[2] };
+	glm::vec3 max { file->header().max[0], file->header().max[1], file->header().max[2] };
+
+	glm::vec3 center = 0.5f * (min + max);
 
 	// Vulkan configuration
 	oak::configure();
@@ -270,52 +243,80 @@ int main(int argc, char *argv[])
 
 	auto commands = device.allocateCommandBuffers(command_buffer_info);
 
-	// Render pass configuration
+	// Every device supports 4x multisampled color and depth attachments
+	constexpr auto samples = vk::SampleCountFlagBits::e4;
+
+	// Render pass configuration; the multisampled color is resolved into
+	// the swapchain image at the end of the subpass
 	auto rpb = oak::RenderPassBuilder(device);
 
 	rpb.add_attachment()
-			.with_final_layout(vk::ImageLayout::ePresentSrcKHR)
+			.with_final_layout(vk::ImageLayout::eColorAttachmentOptimal)
 			.with_initial_layout(vk::ImageLayout::eUndefined)
 			.with_format(window.format)
-			.with_samples(vk::SampleCountFlagBits::e1)
+			.with_samples(samples)
 			.with_load_operation(vk::AttachmentLoadOp::eClear)
-			.with_store_operation(vk::AttachmentStoreOp::eStore)
+			.with_store_operation(vk::AttachmentStoreOp::eDontCare)
 			.done()
 		.add_attachment()
 			.with_final_layout(vk::ImageLayout::eDepthStencilReadOnlyOptimal)
 			.with_initial_layout(vk::ImageLayout::eUndefined)
 			.with_format(vk::Format::eD32Sfloat)
-			.with_samples(vk::SampleCountFlagBits::e1)
+			.with_samples(samples)
 			.with_load_operation(vk::AttachmentLoadOp::eClear)
+			.with_store_operation(vk::AttachmentStoreOp::eDontCare)
+			.done()
+		.add_attachment()
+			.with_final_layout(vk::ImageLayout::ePresentSrcKHR)
+			.with_initial_layout(vk::ImageLayout::eUndefined)
+			.with_format(window.format)
+			.with_samples(vk::SampleCountFlagBits::e1)
+			.with_load_operation(vk::AttachmentLoadOp::eDontCare)
 			.with_store_operation(vk::AttachmentStoreOp::eStore)
 			.done()
 		.add_reference_collection()
 			.with_reference(0, vk::ImageLayout::eColorAttachmentOptimal)
 			.with_reference(1, vk::ImageLayout::eDepthStencilAttachmentOptimal)
+			.with_reference(2, vk::ImageLayout::eColorAttachmentOptimal)
 			.done()
 		.add_subpass()
 			.with_color_attachments(0)
 			.with_depth_attachment(1)
+			.with_resolve_attachment(2)
 			.done();
 
 	auto render_pass = rpb.compile();
 
-	// Depth buffer
-	auto db_config = oak::ImageInfo()
+	// Multisampled color and depth never leave the render pass, so they
+	// are transient attachments, lazily allocated where the device can
+	oak::TransientAttachments attachments;
+
+	uint32_t msaa_color = attachments.add(oak::ImageInfo()
+		.with_format(window.format)
+		.with_size(window.extent())
+		.with_usage(vk::ImageUsageFlagBits::eColorAttachment)
+		.with_aspect(vk::ImageAspectFlagBits::eColor)
+		.with_samples(samples)
+		.with_transient(true));
+
+	uint32_t msaa_depth = attachments.add(oak::ImageInfo()
 		.with_format(vk::Format::eD32Sfloat)
 		.with_size(window.extent())
 		.with_usage(vk::ImageUsageFlagBits::eDepthStencilAttachment)
-		.with_aspect(vk::ImageAspectFlagBits::eDepth);
+		.with_aspect(vk::ImageAspectFlagBits::eDepth)
+		.with_samples(samples)
+		.with_transient(true));
 
-	auto db = oak::Image::from(device, db_config);
+	attachments.build(device);
 
 	// Framebuffer configuration
 	std::vector <vk::Framebuffer> framebuffers;
 
 	for (auto &view : window.views) {
-		std::array <vk::ImageView, 2> views;
-		views[0] = view;
-		views[1] = db.view;
+		std::array <vk::ImageView, 3> views;
+		views[0] = attachments[msaa_color].view;
+		views[1] = attachments[msaa_depth].view;
+		views[2] = view;
 
 		auto fb_info = vk::FramebufferCreateInfo()
 			.setAttachments(views)
@@ -332,69 +333,198 @@ int main(int argc, char *argv[])
 	auto default_fragment = load_module(device, SHADERS "model-viewer-default.frag.spv");
 	auto textured_fragment = load_module(device, SHADERS "model-viewer-textured.frag.spv");
 
+	// Both pipelines declare the texture binding, even though the default
+	// one never reads it, so that they share one layout and switching
+	// between them keeps descriptor sets and push constants bound
+	std::vector <vk::DescriptorSetLayoutBinding> bindings {
+		vk::DescriptorSetLayoutBinding()
+			.setBinding(0)
+			.setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+			.setStageFlags(vk::ShaderStageFlagBits::eFragment)
+			.setDescriptorCount(1),
+	};
+
 	// Default pipeline
 	auto default_config = oak::RasterPipelineInfo <Vertex, MVP> ()
 		.with_vertex(vertex)
 		.with_fragment(default_fragment)
+		.with_bindings(bindings)
 		.with_attachments(false)
+		.with_samples(samples)
 		.with_depth_test(true)
 		.with_depth_write(true);
 
-	auto default_pipeline = compile_pipeline(device, render_pass, default_config);
-
 	// Textured pipeline
-	std::vector <vk::DescriptorSetLayoutBinding> bindings {
-		vk::DescriptorSetLayoutBinding()
-			.setBinding(0)
-			.setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
-			.setStageFlags(vk::ShaderStageFlagBits::eFragment)
-			.setDescriptorCount(1),
-	};
-
 	auto textured_config = oak::RasterPipelineInfo <Vertex, MVP> ()
 		.with_vertex(vertex)
 		.with_fragment(textured_fragment)
 		.with_bindings(bindings)
 		.with_attachments(false)
+		.with_samples(samples)
 		.with_depth_test(true)
 		.with_depth_write(true);
 
-	auto textured_pipeline = compile_pipeline(device, render_pass, textured_config);
+	// Both compile concurrently on the worker pool
+	auto pipelines = oak::compile_pipelines(pool, device, render_pass,
+		std::vector { default_config, textured_config });
+
+	auto default_pipeline = pipelines[0].get();
+	auto textured_pipeline = pipelines[1].get();
+
+	// Allocate mesh resources, uploading all geometry in one submission;
+	// textures are decoded in the background and arrive while rendering
+	oak::StagingUploader uploader(device, resources);
+	oak::TextureLoader loader(device, uploader, pool, decode_image);
+
+	// One vertex buffer, and an index buffer for each index type
+	std::array <uint32_t, 2> index_capacity { 0, 0 };
+	for (const auto &range : file->meshes())
+		index_capacity[range.index_size == sizeof(uint32_t)] += range.index_count;
+
+	auto geometry_pool = oak::GeometryPool::from(device,
+		sizeof(Vertex), file->header().vertex_count,
+		index_capacity[0], index_capacity[1]);
 
-	// Allocate mesh resources
 	std::vector <VulkanMesh> vk_meshes;
 
-	for (const auto &mesh : model) {
-		auto vkm = VulkanMesh::from(device, resources, mesh);
+	for (const auto &range : file->meshes()) {
+		auto vkm = VulkanMesh::from(loader, uploader, geometry_pool, file.value(), range, path.parent_path());
 		vk_meshes.push_back(vkm);
 	}
 
+	// The model is static, so its draws are laid out once; meshes
+	// sharing a material share their state, and draw as one batch
+	oak::IndirectDrawBuilder builder;
+	for (auto &vkm : vk_meshes)
+		builder.add(vkm.material, vkm.geometry);
+
+	std::vector <vk::DrawIndexedIndirectCommand> draw_commands;
+	std::vector <oak::DrawBatch> batches;
+	std::vector <uint32_t> sources;
+
+	builder.build(draw_commands, batches, &sources);
+
+	auto indirect_buffer = uploader.upload(draw_commands,
+		vk::BufferUsageFlagBits::eIndirectBuffer
+		| vk::BufferUsageFlagBits::eStorageBuffer);
+
+	// State of each batch comes from the first mesh of its material
+	std::vector <uint32_t> representative(file->header().material_count, 0);
+	for (uint32_t i = vk_meshes.size(); i-- > 0; )
+		representative[vk_meshes[i].material] = i;
+
+	// Meshes outside the frustum are culled on the GPU when the device
+	// reads draw counts from buffers; otherwise every batch is drawn
+	std::optional <oak::GpuCulling> culling;
+	std::optional <vk::ShaderModule> cull_module;
+
+	std::filesystem::path cull_path = SHADERS "model-viewer-cull.comp.spv";
+
+	if (!oak::GpuCulling::supported(device)) {
+		howl_warning("draw counts from buffers are unsupported, meshes will not be culled");
+	} else if (!std::filesystem::exists(cull_path)) {
+		howl_warning("missing {}, meshes will not be culled", cull_path.string());
+	} else {
+		cull_module = load_module(device, cull_path);
+	}
+
+	if (cull_module.has_value() && cull_module.value()) {
+		std::vector <oak::GpuCulling::Bounds> bounds(draw_commands.size());
+
+		for (uint32_t b = 0; b < batches.size(); b++) {
+			for (uint32_t i = batches[b].first; i < batches[b].first + batches[b].count; i++) {
+				auto &vkm = vk_meshes[sources[i]];
+
+				auto &entry = bounds[i];
+				entry.center[0] = vkm.center.x;
+				entry.center[1] = vkm.center.y;
+				entry.center[2] = vkm.center.z;
+				entry.radius = vkm.radius;
+				entry.batch = b;
+				entry.base = batches[b].first;
+			}
+		}
+
+		culling = oak::GpuCulling::from(device, uploader, cull_module.value(),
+			indirect_buffer, bounds, batches.size(), window.images.size());
+	}
+
+	uploader.flush();
+
+	// Everything needed is now in device memory
+	file->unmap();
+
 	// Link descriptor sets
-	for (auto &vkm : vk_meshes) {
-		if (vkm.has_texture) {
-			auto alloc_info = vk::DescriptorSetAllocateInfo()
-				.setDescriptorPool(resources.descriptor_pool)
-				.setSetLayouts(textured_pipeline.dsl.value());
+	auto sampler_info = vk::SamplerCreateInfo()
+		.setMinLod(0)
+		.setMaxLod(VK_LOD_CLAMP_NONE)
+		.setMipmapMode(vk::SamplerMipmapMode::eLinear)
+		.setMagFilter(vk::Filter::eLinear)
+		.setMinFilter(vk::Filter::eLinear);
+
+	auto albedo_sampler = device.createSampler(sampler_info);
+
+	uint32_t frames = window.images.size();
 
-			vkm.descriptor = device.allocateDescriptorSets(alloc_info).front();
+	// Textures stream towards what their coverage needs, within budget
+	oak::TextureResidency residency(loader, texture_budget << 20);
 
-			auto albedo_info = vk::DescriptorImageInfo()
-				.setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
-				.setImageView(vkm.albedo_image.view)
-				.setSampler(vkm.albedo_sampler);
+	loader.latency = frames;
+	// Only the meshes standing in for a material need sets
+	uint32_t textured = std::count_if(representative.begin(), representative.end(),
+		[&](uint32_t i) { return vk_meshes[i].has_texture; });
 
-			auto write = vk::WriteDescriptorSet()
-				.setImageInfo(albedo_info)
-				.setDstBinding(0)
-				.setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
-				.setDstSet(vkm.descriptor);
+	auto pool_size = vk::DescriptorPoolSize()
+		.setType(vk::DescriptorType::eCombinedImageSampler)
+		.setDescriptorCount(std::max(textured * frames, 1u));
 
-			device.updateDescriptorSets(write, {}, {});
+	auto pool_info = vk::DescriptorPoolCreateInfo()
+		.setPoolSizes(pool_size)
+		.setMaxSets(std::max(textured * frames, 1u));
+
+	auto descriptor_pool = device.createDescriptorPool(pool_info);
+
+	std::vector <vk::DescriptorSetLayout> layouts(frames, textured_pipeline.dsl.value());
+
+	for (uint32_t i : representative) {
+		auto &vkm = vk_meshes[i];
+		if (!vkm.descriptors.empty())
+			continue;
+
+		if (vkm.has_texture) {
+			auto alloc_info = vk::DescriptorSetAllocateInfo()
+				.setDescriptorPool(descriptor_pool)
+				.setSetLayouts(layouts);
+
+			vkm.descriptors = device.allocateDescriptorSets(alloc_info);
+			vkm.bound.resize(frames);
 		} else if (glm::length(vkm.albedo_color) < 1e-6f) {
 			vkm.albedo_color = glm::vec3(0.5f, 0.8f, 0.8f);
 		}
 	}
 
+	// Points the frame's set at the texture, or at the placeholder
+	auto link = [&](VulkanMesh &vkm, uint32_t frame) {
+		auto &view = loader.image(vkm.albedo).view;
+		if (vkm.bound[frame] == view)
+			return;
+
+		auto albedo_info = vk::DescriptorImageInfo()
+			.setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+			.setImageView(view)
+			.setSampler(albedo_sampler);
+
+		auto write = vk::WriteDescriptorSet()
+			.setImageInfo(albedo_info)
+			.setDstBinding(0)
+			.setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+			.setDstSet(vkm.descriptors[frame]);
+
+		device.updateDescriptorSets(write, {}, {});
+
+		vkm.bound[frame] = view;
+	};
+
 	// Prepare camera and model matrices
 	g_state.center = center;
 	g_state.radius = glm::length(max - min);
@@ -412,9 +542,23 @@ int main(int argc, char *argv[])
 	glfwSetCursorPosCallback(window.glfw, cursor_callback);
 	glfwSetScrollCallback(window.glfw, scroll_callback);
 
+	// The loop renders each frame in flight in turn, and only after its
+	// previous submission has retired, so its sets are free to update
+	uint32_t next_frame = 0;
+
+	// Batches are sorted by state and nearest mesh every frame
+	oak::DrawList draw_list;
+	draw_list.max_draws = geometry_pool.max_draws;
+
+	std::vector <float> nearest(representative.size());
+	uint64_t frame_count = 0;
+
 	auto render = [&](const vk::CommandBuffer &cmd, uint32_t image_index) {
                	auto &framebuffer = framebuffers[image_index];
 
+		uint32_t frame = next_frame;
+		next_frame = (next_frame + 1) % frames;
+
                	if (glfwGetKey(window.glfw, GLFW_KEY_Q) == GLFW_PRESS) {
                         glfwSetWindowShouldClose(window.glfw, true);
                         return;
@@ -449,8 +593,6 @@ int main(int argc, char *argv[])
         		.setClearValues(clear_values)
         		.setFramebuffer(framebuffer);
 
-        	cmd.beginRenderPass(rp_begin_info, vk::SubpassContents::eInline);
-
      	 	MVP push_constants;
 
 		// Rotate the model matrix
@@ -465,32 +607,117 @@ int main(int argc, char *argv[])
 
 		push_constants.light_direction = glm::normalize(glm::vec3 { 1.0f, 1.0f, 1.0f });
 
+		// Coverage assumes the texture spans the mesh once
+		float focal = window.height / (2.0f * std::tan(glm::radians(45.0f) / 2.0f));
+
+		std::fill(nearest.begin(), nearest.end(), FLT_MAX);
+
 		for (auto &vkm : vk_meshes) {
+			glm::vec4 center = g_state.view * glm::vec4(vkm.center, 1.0f);
+
+			float distance = -center.z;
+			nearest[vkm.material] = std::min(nearest[vkm.material], distance - vkm.radius);
+
+			if (!vkm.has_texture)
+				continue;
+
+			// Behind the camera, so not sampled at all
+			if (distance + vkm.radius <= 0.0f)
+				continue;
+
+			float pixels = 2.0f * vkm.radius * focal / std::max(distance, 1e-3f);
+			residency.sample(vkm.albedo, pixels);
+		}
+
+		residency.update();
+
+		// Upload whatever finished decoding since the last frame
+		loader.poll();
+
+		// Optimized pipelines replace the fast linked ones when ready
+		default_pipeline.poll();
+		textured_pipeline.poll();
+
+		// Culling runs before the render pass, since dispatches cannot
+		// be recorded inside one
+		if (culling) {
+			glm::mat4 view_projection = push_constants.proj * push_constants.view;
+			culling->dispatch(cmd, frame, &view_projection[0][0]);
+		}
+
+        	cmd.beginRenderPass(rp_begin_info, vk::SubpassContents::eInline);
+
+		// One indirect draw per material and index type
+		constexpr vk::DeviceSize stride = sizeof(vk::DrawIndexedIndirectCommand);
+
+		for (uint32_t b = 0; b < batches.size(); b++) {
+			auto &batch = batches[b];
+			auto &vkm = vk_meshes[representative[batch.key]];
+
 			push_constants.albedo_color = vkm.albedo_color;
 
+			oak::DrawState state;
+			state.vertex_buffer = geometry_pool.vertices.buffer.handle;
+			state.index_buffer = geometry_pool.indices(batch.index_type).buffer.handle;
+			state.index_type = batch.index_type;
+
 			if (vkm.has_texture) {
-				cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, textured_pipeline.handle);
-				cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, textured_pipeline.layout, 0, vkm.descriptor, {});
-				cmd.pushConstants <MVP> (textured_pipeline.layout, vk::ShaderStageFlagBits::eVertex, 0, push_constants);
+				link(vkm, frame);
+
+				state.pipeline = textured_pipeline.handle;
+				state.layout = textured_pipeline.layout;
+				state.descriptors = vkm.descriptors[frame];
 			} else {
-				cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, default_pipeline.handle);
-				cmd.pushConstants <MVP> (default_pipeline.layout, vk::ShaderStageFlagBits::eVertex, 0, push_constants);
+				state.pipeline = default_pipeline.handle;
+				state.layout = default_pipeline.layout;
 			}
 
-			cmd.bindVertexBuffers(0, vkm.vertex_buffer.handle, { 0 });
-			cmd.bindIndexBuffer(vkm.index_buffer.handle, 0, vk::IndexType::eUint32);
-			cmd.drawIndexed(vkm.index_count, 1, 0, 0, 0);
+			if (culling) {
+				draw_list.add(state, nearest[batch.key], push_constants,
+					culling->visible[frame].handle, batch.first * stride,
+					culling->counts[frame].handle, b * sizeof(uint32_t), batch.count);
+			} else {
+				draw_list.add(state, nearest[batch.key], push_constants,
+					indirect_buffer.handle, batch.first * stride, batch.count);
+			}
+		}
+
+		draw_list.record(cmd);
+
+		// Binds recorded and skipped, refreshed about once a second
+		if (frame_count++ % 60 == 0) {
+			auto &stats = draw_list.stats;
+			fmt::print(CLEAR_LINE "{} draws | binds issued/skipped: pipelines {}/{}, sets {}/{}, buffers {}/{}, constants {}/{}",
+				stats.draws,
+				stats.pipelines.issued, stats.pipelines.skipped,
+				stats.descriptors.issued, stats.descriptors.skipped,
+				stats.vertex_buffers.issued + stats.index_buffers.issued,
+				stats.vertex_buffers.skipped + stats.index_buffers.skipped,
+				stats.push_constants.issued, stats.push_constants.skipped);
+
+			fflush(stdout);
 		}
 
         	cmd.endRenderPass();
 	};
 
 	auto resize = [&]() {
+		for (auto &framebuffer : framebuffers)
+			device.destroyFramebuffer(framebuffer);
+
 		framebuffers.clear();
 
+		// Attachments follow the swapchain extent
+		attachments.resize(device, window.extent());
+
 		for (auto &view : window.views) {
+			std::array <vk::ImageView, 3> views;
+			views[0] = attachments[msaa_color].view;
+			views[1] = attachments[msaa_depth].view;
+			views[2] = view;
+
 			auto fb_info = vk::FramebufferCreateInfo()
-				.setAttachments(view)
+				.setAttachments(views)
 				.setWidth(window.width)
 				.setHeight(window.height)
 				.setLayers(1)
@@ -503,6 +730,29 @@ int main(int argc, char *argv[])
 	oak::primary_render_loop(device, resources, window, render, resize);
 
 	device.waitIdle();
+	device.savePipelineCache();
+	device.pipeline_registry->destroy();
+	device.pipeline_cache->destroy();
+
+	loader.destroy();
+	uploader.destroy();
+
+	geometry_pool.destroy(device);
+	indirect_buffer.destroy(device);
+
+	if (culling) {
+		culling->destroy(device);
+		device.destroyShaderModule(cull_module.value());
+	}
+
+	device.destroyDescriptorPool(descriptor_pool);
+	device.destroySampler(albedo_sampler);
+
+	for (auto &framebuffer : framebuffers)
+		device.destroyFramebuffer(framebuffer);
+
+	attachments.destroy(device);
+
 	window.destroy(device);
 }
 
@@ -573,120 +823,3 @@ void scroll_callback(GLFWwindow *window, double xoffset, double yoffset)
 	g_state.radius_scale = glm::clamp(g_state.radius_scale, 0.1f, 10.0f);
 	rotate_view(0.0, 0.0);
 }
-
-Mesh process_mesh(aiMesh *mesh, const aiScene *scene, const std::filesystem::path &directory)
-{
-	// Mesh data
-	std::vector <Vertex> vertices;
-	std::vector <uint32_t> triangles;
-
-	// Process all the mesh's vertices
-	for (size_t i = 0; i < mesh->mNumVertices; i++) {
-		Vertex v;
-
-		v.position = {
-			mesh->mVertices[i].x,
-			mesh->mVertices[i].y,
-			mesh->mVertices[i].z
-		};
-
-		if (mesh->HasNormals()) {
-			v.normal = {
-				mesh->mNormals[i].x,
-				mesh->mNormals[i].y,
-				mesh->mNormals[i].z
-			};
-		}
-
-		if (mesh->HasTextureCoords(0)) {
-			v.uv = {
-				mesh->mTextureCoords[0][i].x,
-				mesh->mTextureCoords[0][i].y
-			};
-		}
-
-		vertices.push_back(v);
-	}
-
-	// Process all the mesh's triangles
-	std::stack <size_t> buffer;
-	for (size_t i = 0; i < mesh->mNumFaces; i++) {
-		aiFace face = mesh->mFaces[i];
-		for (size_t j = 0; j < face.mNumIndices; j++) {
-			buffer.push(face.mIndices[j]);
-			if (buffer.size() >= 3) {
-				size_t i0 = buffer.top(); buffer.pop();
-				size_t i1 = buffer.top(); buffer.pop();
-				size_t i2 = buffer.top(); buffer.pop();
-
-				triangles.push_back(i0);
-				triangles.push_back(i1);
-				triangles.push_back(i2);
-			}
-		}
-	}
-
-	Mesh new_mesh { vertices, triangles };
-
-	// Process materials
-	aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-
-	// Get albedo, specular and shininess
-	aiVector3D albedo;
-	material->Get(AI_MATKEY_COLOR_DIFFUSE, albedo);
-	new_mesh.albedo_color = glm::vec3 { albedo.x, albedo.y, albedo.z };
-
-	// Load diffuse/albedo texture
-	aiString path;
-	if (material->GetTexture(aiTextureType_DIFFUSE, 0, &path) == AI_SUCCESS) {
-		std::string path_string = path.C_Str();
-		std::replace(path_string.begin(), path_string.end(), '\\', '/');
-		std::filesystem::path texture_path = path_string;
-		new_mesh.albedo_path = directory / texture_path;
-	}
-
-	return new_mesh;
-}
-
-Model process_node(aiNode *node, const aiScene *scene, const std::filesystem::path &directory)
-{
-	Model model;
-
-	for (size_t i = 0; i < node->mNumMeshes; i++) {
-		aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-                Mesh processed_mesh = process_mesh(mesh, scene, directory);
-		if (processed_mesh.indices.size() > 0)
-			model.push_back(processed_mesh);
-	}
-
-	// Recusively process all the node's children
-	for (size_t i = 0; i < node->mNumChildren; i++) {
-		Model processed_models = process_node(node->mChildren[i], scene, directory);
-		if (processed_models.size() > 0)
-			model.insert(model.end(), processed_models.begin(), processed_models.end());
-	}
-
-	return model;
-}
-
-Model load_model(const std::filesystem::path &path)
-{
-	Assimp::Importer importer;
-
-	// Read scene
-	const aiScene *scene = importer.ReadFile(
-		path, aiProcess_Triangulate
-			| aiProcess_GenNormals
-			| aiProcess_FlipUVs
-	);
-
-	// Check if the scene was loaded
-	if (!scene | scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE
-			|| !scene->mRootNode) {
-		fprintf(stderr, "Assimp error: \"%s\"\n", importer.GetErrorString());
-		return {};
-	}
-
-	// Process the scene (root node)
-	return process_node(scene->mRootNode, scene, path.parent_path());
-}
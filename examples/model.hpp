@@ -0,0 +1,560 @@
+#pragma once
+
+// Standard libraries
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+// POSIX memory mapping
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <vulkan/vulkan.hpp>
+
+// GLM for vector math
+#include <glm/glm.hpp>
+
+// Meshes are imported in parallel
+#include <thread-pool.hpp>
+
+// Assimp for mesh loading
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#include <assimp/material.h>
+
+// Vertex data
+struct Vertex {
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec2 uv;
+
+	static vk::VertexInputBindingDescription binding() {
+		return vk::VertexInputBindingDescription()
+			.setBinding(0)
+			.setInputRate(vk::VertexInputRate::eVertex)
+			.setStride(sizeof(Vertex));
+	}
+
+	static std::vector <vk::VertexInputAttributeDescription> attributes() {
+		return {
+			vk::VertexInputAttributeDescription()
+				.setBinding(0)
+				.setFormat(vk::Format::eR32G32B32Sfloat)
+				.setLocation(0)
+				.setOffset(offsetof(Vertex, position)),
+			vk::VertexInputAttributeDescription()
+				.setBinding(0)
+				.setFormat(vk::Format::eR32G32B32Sfloat)
+				.setLocation(1)
+				.setOffset(offsetof(Vertex, normal)),
+			vk::VertexInputAttributeDescription()
+				.setBinding(0)
+				.setFormat(vk::Format::eR32G32Sfloat)
+				.setLocation(2)
+				.setOffset(offsetof(Vertex, uv)),
+		};
+	}
+};
+
+// Mesh and mesh loading
+struct Mesh {
+	std::vector <Vertex> vertices;
+	std::vector <uint32_t> indices;
+
+	std::filesystem::path albedo_path;
+
+	glm::vec3 albedo_color = glm::vec3(1.0f);
+};
+
+using Model = std::vector <Mesh>;
+
+// Writes straight into arrays sized from the mesh; triangulation leaves
+// three indices per face, besides points and lines, which are skipped
+inline Mesh process_mesh(const aiMesh *mesh, const aiScene *scene, const std::filesystem::path &directory)
+{
+	Mesh new_mesh;
+
+	// Process all the mesh's vertices
+	new_mesh.vertices.resize(mesh->mNumVertices);
+
+	Vertex *vertices = new_mesh.vertices.data();
+
+	bool normals = mesh->HasNormals();
+	bool uvs = mesh->HasTextureCoords(0);
+
+	for (size_t i = 0; i < mesh->mNumVertices; i++) {
+		auto &position = mesh->mVertices[i];
+		vertices[i].position = { position.x, position.y, position.z };
+
+		if (normals) {
+			auto &normal = mesh->mNormals[i];
+			vertices[i].normal = { normal.x, normal.y, normal.z };
+		} else {
+			vertices[i].normal = glm::vec3(0.0f);
+		}
+
+		if (uvs) {
+			auto &uv = mesh->mTextureCoords[0][i];
+			vertices[i].uv = { uv.x, uv.y };
+		} else {
+			vertices[i].uv = glm::vec2(0.0f);
+		}
+	}
+
+	// Process all the mesh's triangles
+	size_t triangles = 0;
+	for (size_t i = 0; i < mesh->mNumFaces; i++)
+		triangles += (mesh->mFaces[i].mNumIndices == 3);
+
+	new_mesh.indices.resize(3 * triangles);
+
+	uint32_t *indices = new_mesh.indices.data();
+
+	for (size_t i = 0; i < mesh->mNumFaces; i++) {
+		const aiFace &face = mesh->mFaces[i];
+		if (face.mNumIndices != 3)
+			continue;
+
+		// Reversed, which is the winding the pipelines expect
+		indices[0] = face.mIndices[2];
+		indices[1] = face.mIndices[1];
+		indices[2] = face.mIndices[0];
+		indices += 3;
+	}
+
+	// Process materials
+	aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
+
+	// Get albedo, specular and shininess
+	aiVector3D albedo;
+	material->Get(AI_MATKEY_COLOR_DIFFUSE, albedo);
+	new_mesh.albedo_color = glm::vec3 { albedo.x, albedo.y, albedo.z };
+
+	// Load diffuse/albedo texture
+	aiString path;
+	if (material->GetTexture(aiTextureType_DIFFUSE, 0, &path) == AI_SUCCESS) {
+		std::string path_string = path.C_Str();
+		std::replace(path_string.begin(), path_string.end(), '\\', '/');
+		std::filesystem::path texture_path = path_string;
+		new_mesh.albedo_path = directory / texture_path;
+	}
+
+	return new_mesh;
+}
+
+// Flattens the hierarchy into the order its meshes are drawn in
+inline void collect_meshes(const aiNode *node, std::vector <uint32_t> &order)
+{
+	order.insert(order.end(), node->mMeshes, node->mMeshes + node->mNumMeshes);
+
+	for (size_t i = 0; i < node->mNumChildren; i++)
+		collect_meshes(node->mChildren[i], order);
+}
+
+inline Model load_model(const std::filesystem::path &path, oak::ThreadPool &pool)
+{
+	Assimp::Importer importer;
+
+	// Read scene
+	const aiScene *scene = importer.ReadFile(
+		path, aiProcess_Triangulate
+			| aiProcess_GenNormals
+			| aiProcess_FlipUVs
+	);
+
+	// Check if the scene was loaded
+	if (!scene || (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE)
+			|| !scene->mRootNode) {
+		fprintf(stderr, "Assimp error: \"%s\"\n", importer.GetErrorString());
+		return {};
+	}
+
+	std::vector <uint32_t> order;
+	collect_meshes(scene->mRootNode, order);
+
+	// Nodes may share a mesh, which is still processed only once
+	std::vector <uint32_t> references(scene->mNumMeshes, 0);
+	for (uint32_t index : order)
+		references[index]++;
+
+	std::vector <Mesh> processed(scene->mNumMeshes);
+	std::vector <std::future <void>> pending;
+
+	auto directory = path.parent_path();
+
+	for (uint32_t i = 0; i < scene->mNumMeshes; i++) {
+		if (references[i] == 0)
+			continue;
+
+		// Every task writes its own slot
+		pending.push_back(pool.submit([&, i]() {
+			processed[i] = process_mesh(scene->mMeshes[i], scene, directory);
+		}));
+	}
+
+	for (auto &future : pending)
+		future.get();
+
+	// The last reference takes the mesh, earlier ones copy it
+	Model model;
+	model.reserve(order.size());
+
+	for (uint32_t index : order) {
+		if (processed[index].indices.empty())
+			continue;
+
+		if (--references[index] == 0)
+			model.push_back(std::move(processed[index]));
+		else
+			model.push_back(processed[index]);
+	}
+
+	return model;
+}
+
+// Binary model container (.oakm), laid out as a header followed by the
+// mesh ranges, the materials, a block of null terminated strings, and the
+// interleaved vertex and index streams of every mesh. Sections start on
+// 16 byte boundaries, so a memory mapped file is read in place and its
+// streams are copied into staging memory as they are. Meshes with fewer
+// than 65536 vertices store 16-bit indices, the rest 32-bit ones
+struct ModelFile {
+	static constexpr std::array <char, 4> magic { 'O', 'A', 'K', 'M' };
+	static constexpr uint32_t version = 2;
+	static constexpr uint32_t none = ~0u;
+
+	struct Header {
+		std::array <char, 4> magic;
+		uint32_t version;
+		uint32_t vertex_stride;
+		uint32_t reserved;
+
+		uint32_t mesh_count;
+		uint32_t material_count;
+
+		// Bounds of the whole model
+		float min[3];
+		float max[3];
+
+		// Offsets of each section from the start of the file
+		uint64_t meshes;
+		uint64_t materials;
+		uint64_t strings;
+		uint64_t strings_size;
+		uint64_t vertices;
+		uint64_t vertex_count;
+		uint64_t indices;
+		uint64_t indices_size;
+		uint64_t index_count;
+	};
+
+	// Indices are relative to the mesh's first vertex; first_index counts
+	// in the mesh's own index size, so a stream bound at the start of the
+	// section with that index type draws it as is
+	struct Range {
+		uint32_t first_vertex;
+		uint32_t vertex_count;
+		uint32_t first_index;
+		uint32_t index_count;
+		uint32_t index_size;
+		uint32_t material;
+
+		float min[3];
+		float max[3];
+	};
+
+	// Texture paths are relative to the file's directory, unless absolute
+	struct Material {
+		float albedo_color[3];
+		uint32_t albedo_path = none;
+	};
+
+	// Either a read only mapping of the file or bytes packed in memory
+	void *mapping = nullptr;
+	size_t size = 0;
+	std::vector <uint8_t> packed;
+
+	const uint8_t *bytes() const {
+		return mapping ? (const uint8_t *) mapping : packed.data();
+	}
+
+	const Header &header() const {
+		return *(const Header *) bytes();
+	}
+
+	std::span <const Range> meshes() const {
+		return { (const Range *) (bytes() + header().meshes), header().mesh_count };
+	}
+
+	std::span <const Material> materials() const {
+		return { (const Material *) (bytes() + header().materials), header().material_count };
+	}
+
+	std::span <const Vertex> vertices() const {
+		return { (const Vertex *) (bytes() + header().vertices), header().vertex_count };
+	}
+
+	// Mixed 16 and 32-bit indices, so only as bytes
+	std::span <const uint8_t> indices() const {
+		return { bytes() + header().indices, header().indices_size };
+	}
+
+	const char *string(uint32_t offset) const {
+		return (const char *) bytes() + header().strings + offset;
+	}
+
+	// Checks that every section is aligned and lies within the file
+	bool valid() const {
+		if (size < sizeof(Header))
+			return false;
+
+		auto &h = header();
+		if (h.magic != magic || h.version != version)
+			return false;
+
+		if (h.vertex_stride != sizeof(Vertex))
+			return false;
+
+		// Sections are read in place, so they keep the alignment the
+		// converter wrote them with
+		auto aligned = [](uint64_t offset) {
+			return offset % 16 == 0;
+		};
+
+		bool alignment = aligned(h.meshes)
+			&& aligned(h.materials)
+			&& aligned(h.strings)
+			&& aligned(h.vertices)
+			&& aligned(h.indices);
+
+		if (!alignment)
+			return false;
+
+		// Counts are divided into the space left rather than multiplied
+		// by the element size, which could wrap around
+		auto within = [&](uint64_t offset, uint64_t count, uint64_t element) {
+			return offset <= size && count <= (size - offset) / element;
+		};
+
+		bool sections = within(h.meshes, h.mesh_count, sizeof(Range))
+			&& within(h.materials, h.material_count, sizeof(Material))
+			&& within(h.strings, h.strings_size, 1)
+			&& within(h.vertices, h.vertex_count, sizeof(Vertex))
+			&& within(h.indices, h.indices_size, 1)
+			&& (h.strings_size == 0 || bytes()[h.strings + h.strings_size - 1] == '\0');
+
+		if (!sections)
+			return false;
+
+		for (auto &range : meshes()) {
+			bool sized = (range.index_size == sizeof(uint16_t))
+				|| (range.index_size == sizeof(uint32_t));
+
+			bool inside = sized && (range.material < h.material_count)
+				&& (uint64_t(range.first_vertex) + range.vertex_count <= h.vertex_count)
+				&& ((uint64_t(range.first_index) + range.index_count) * range.index_size <= h.indices_size);
+
+			if (!inside)
+				return false;
+		}
+
+		for (auto &material : materials()) {
+			if (material.albedo_path != none && material.albedo_path >= h.strings_size)
+				return false;
+		}
+
+		return true;
+	}
+
+	static std::optional <ModelFile> map(const std::filesystem::path &path) {
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return std::nullopt;
+
+		struct stat info;
+		if (fstat(fd, &info) < 0 || info.st_size == 0) {
+			close(fd);
+			return std::nullopt;
+		}
+
+		// The mapping outlives the descriptor
+		void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+
+		if (mapping == MAP_FAILED)
+			return std::nullopt;
+
+		// Both streams are read front to back into staging memory
+		madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+		madvise(mapping, info.st_size, MADV_WILLNEED);
+
+		ModelFile result;
+		result.mapping = mapping;
+		result.size = info.st_size;
+
+		if (!result.valid()) {
+			fprintf(stderr, "%s is not a valid model file\n", path.c_str());
+			result.unmap();
+			return std::nullopt;
+		}
+
+		return result;
+	}
+
+	void unmap() {
+		if (mapping)
+			munmap(mapping, size);
+
+		mapping = nullptr;
+		size = 0;
+		packed.clear();
+	}
+
+	bool write(const std::filesystem::path &path) const {
+		std::ofstream file(path, std::ios::binary);
+		file.write((const char *) bytes(), size);
+		return file.good();
+	}
+
+	// Lays out the model in the container format, deduplicating materials;
+	// texture paths are stored relative to the given directory
+	static ModelFile pack(const Model &model, const std::filesystem::path &directory) {
+		auto align = [](uint64_t offset) {
+			return (offset + 15) & ~uint64_t(15);
+		};
+
+		std::vector <Range> ranges;
+		std::vector <Material> materials;
+		std::vector <std::string> albedo_paths;
+		std::string strings;
+
+		Header header {};
+		header.magic = magic;
+		header.version = version;
+		header.vertex_stride = sizeof(Vertex);
+
+		glm::vec3 model_min = glm::vec3(FLT_MAX);
+		glm::vec3 model_max = glm::vec3(-FLT_MAX);
+
+		for (const auto &mesh : model) {
+			std::string albedo_path;
+			if (!mesh.albedo_path.empty()) {
+				auto relative = mesh.albedo_path.lexically_relative(directory);
+				albedo_path = relative.empty() ? mesh.albedo_path.string() : relative.string();
+			}
+
+			// Meshes sharing a material point to the same entry
+			uint32_t material = none;
+			for (uint32_t i = 0; i < materials.size(); i++) {
+				bool same = (albedo_paths[i] == albedo_path)
+					&& !std::memcmp(materials[i].albedo_color, &mesh.albedo_color, sizeof(float) * 3);
+
+				if (same) {
+					material = i;
+					break;
+				}
+			}
+
+			if (material == none) {
+				Material entry;
+				std::memcpy(entry.albedo_color, &mesh.albedo_color, sizeof(float) * 3);
+
+				if (!albedo_path.empty()) {
+					entry.albedo_path = strings.size();
+					strings += albedo_path;
+					strings += '\0';
+				}
+
+				material = materials.size();
+				materials.push_back(entry);
+				albedo_paths.push_back(albedo_path);
+			}
+
+			glm::vec3 min = glm::vec3(FLT_MAX);
+			glm::vec3 max = glm::vec3(-FLT_MAX);
+
+			for (const Vertex &vertex : mesh.vertices) {
+				min = glm::min(min, vertex.position);
+				max = glm::max(max, vertex.position);
+			}
+
+			model_min = glm::min(model_min, min);
+			model_max = glm::max(model_max, max);
+
+			// Every mesh's indices start on a 4 byte boundary, which
+			// is a multiple of either index size
+			Range range;
+			range.first_vertex = header.vertex_count;
+			range.vertex_count = mesh.vertices.size();
+			range.index_size = (mesh.vertices.size() < 65536) ? sizeof(uint16_t) : sizeof(uint32_t);
+			range.first_index = ((header.indices_size + 3) & ~uint64_t(3)) / range.index_size;
+			range.index_count = mesh.indices.size();
+			range.material = material;
+
+			std::memcpy(range.min, &min, sizeof(range.min));
+			std::memcpy(range.max, &max, sizeof(range.max));
+
+			ranges.push_back(range);
+
+			header.vertex_count += mesh.vertices.size();
+			header.index_count += mesh.indices.size();
+			header.indices_size = uint64_t(range.first_index + range.index_count) * range.index_size;
+		}
+
+		std::memcpy(header.min, &model_min, sizeof(header.min));
+		std::memcpy(header.max, &model_max, sizeof(header.max));
+
+		header.mesh_count = ranges.size();
+		header.material_count = materials.size();
+
+		header.meshes = align(sizeof(Header));
+		header.materials = align(header.meshes + ranges.size() * sizeof(Range));
+		header.strings = align(header.materials + materials.size() * sizeof(Material));
+		header.strings_size = strings.size();
+		header.vertices = align(header.strings + strings.size());
+		header.indices = align(header.vertices + header.vertex_count * sizeof(Vertex));
+
+		ModelFile result;
+		result.size = header.indices + header.indices_size;
+		result.packed.resize(result.size);
+
+		uint8_t *bytes = result.packed.data();
+
+		std::memcpy(bytes, &header, sizeof(Header));
+		std::memcpy(bytes + header.meshes, ranges.data(), ranges.size() * sizeof(Range));
+		std::memcpy(bytes + header.materials, materials.data(), materials.size() * sizeof(Material));
+		std::memcpy(bytes + header.strings, strings.data(), strings.size());
+
+		// Each mesh's streams follow those of the previous one
+		for (size_t i = 0; i < model.size(); i++) {
+			auto &mesh = model[i];
+			auto &range = ranges[i];
+
+			std::memcpy(bytes + header.vertices + range.first_vertex * sizeof(Vertex),
+				mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+
+			uint8_t *indices = bytes + header.indices + uint64_t(range.first_index) * range.index_size;
+
+			if (range.index_size == sizeof(uint32_t)) {
+				std::memcpy(indices, mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+			} else {
+				uint16_t *narrow = (uint16_t *) indices;
+				for (size_t j = 0; j < mesh.indices.size(); j++)
+					narrow[j] = mesh.indices[j];
+			}
+		}
+
+		return result;
+	}
+};
@@ -0,0 +1,358 @@
+#pragma once
+
+// Standard libraries
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <numeric>
+#include <vector>
+
+// Meshes and the thread pool they are optimized on
+#include "model.hpp"
+
+// Mesh optimization between import and upload; welding shrinks the vertex
+// stream, then triangles are ordered for the post-transform cache and for
+// overdraw, and vertices for fetch locality
+
+// Merges vertices that are identical bit for bit, dropping the triangles
+// that become degenerate
+inline void weld_vertices(Mesh &mesh)
+{
+	size_t count = mesh.vertices.size();
+
+	// Open addressing over the unique vertices, at most half full
+	size_t capacity = std::bit_ceil(2 * count + 1);
+
+	std::vector <uint32_t> table(capacity, ~0u);
+	std::vector <uint32_t> remap(count);
+	std::vector <Vertex> unique;
+	unique.reserve(count);
+
+	for (size_t i = 0; i < count; i++) {
+		const Vertex &vertex = mesh.vertices[i];
+
+		// 64-bit FNV-1a
+		uint64_t hash = 0xCBF29CE484222325ull;
+		for (size_t b = 0; b < sizeof(Vertex); b++) {
+			hash ^= ((const uint8_t *) &vertex)[b];
+			hash *= 0x100000001B3ull;
+		}
+
+		size_t slot = hash & (capacity - 1);
+		while (true) {
+			uint32_t index = table[slot];
+
+			if (index == ~0u) {
+				table[slot] = unique.size();
+				remap[i] = unique.size();
+				unique.push_back(vertex);
+				break;
+			}
+
+			if (!std::memcmp(&unique[index], &vertex, sizeof(Vertex))) {
+				remap[i] = index;
+				break;
+			}
+
+			slot = (slot + 1) & (capacity - 1);
+		}
+	}
+
+	size_t kept = 0;
+	for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+		uint32_t a = remap[mesh.indices[i + 0]];
+		uint32_t b = remap[mesh.indices[i + 1]];
+		uint32_t c = remap[mesh.indices[i + 2]];
+
+		if (a == b || b == c || c == a)
+			continue;
+
+		mesh.indices[kept++] = a;
+		mesh.indices[kept++] = b;
+		mesh.indices[kept++] = c;
+	}
+
+	mesh.indices.resize(kept);
+	mesh.vertices = std::move(unique);
+}
+
+// Orders triangles for a post-transform cache of unknown size, following
+// Forsyth's linear-speed vertex cache optimization: vertices score higher
+// the more recently they were used and the fewer triangles they have left,
+// and the next triangle is the best scoring one around the cached vertices
+inline void optimize_vertex_cache(Mesh &mesh)
+{
+	constexpr size_t cache_size = 32;
+
+	auto &indices = mesh.indices;
+
+	size_t vertex_count = mesh.vertices.size();
+	size_t triangle_count = indices.size() / 3;
+
+	if (triangle_count == 0)
+		return;
+
+	// Triangles around each vertex, as rows of one array; the first
+	// remaining[v] entries of a row are those not yet emitted
+	std::vector <uint32_t> offsets(vertex_count + 1, 0);
+	for (uint32_t index : indices)
+		offsets[index + 1]++;
+
+	std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+	std::vector <uint32_t> adjacency(indices.size());
+	std::vector <uint32_t> remaining(vertex_count, 0);
+
+	for (uint32_t t = 0; t < triangle_count; t++) {
+		for (uint32_t k = 0; k < 3; k++) {
+			uint32_t v = indices[3 * t + k];
+			adjacency[offsets[v] + remaining[v]++] = t;
+		}
+	}
+
+	auto score = [&](int32_t position, uint32_t valence) {
+		if (valence == 0)
+			return -1.0f;
+
+		float result = 0.0f;
+		if (position >= 0) {
+			// The last triangle's vertices score the same, so that
+			// triangles sharing an edge are not favored over each other
+			if (position < 3)
+				result = 0.75f;
+			else
+				result = std::pow(1.0f - float(position - 3) / float(cache_size - 3), 1.5f);
+		}
+
+		// Finishing off vertices with few triangles left
+		return result + 2.0f / std::sqrt(float(valence));
+	};
+
+	std::vector <int32_t> position(vertex_count, -1);
+	std::vector <float> vertex_score(vertex_count);
+
+	for (size_t v = 0; v < vertex_count; v++)
+		vertex_score[v] = score(-1, remaining[v]);
+
+	std::vector <bool> emitted(triangle_count, false);
+
+	std::vector <uint32_t> cache;
+	std::vector <uint32_t> next_cache;
+
+	std::vector <uint32_t> result;
+	result.reserve(indices.size());
+
+	uint32_t best = ~0u;
+	uint32_t cursor = 0;
+
+	for (size_t n = 0; n < triangle_count; n++) {
+		// Nothing around the cache, so carry on in the original order
+		if (best == ~0u) {
+			while (emitted[cursor])
+				cursor++;
+
+			best = cursor;
+		}
+
+		uint32_t t = best;
+		emitted[t] = true;
+
+		const uint32_t *triangle = &indices[3 * t];
+
+		for (uint32_t k = 0; k < 3; k++) {
+			uint32_t v = triangle[k];
+			result.push_back(v);
+
+			auto begin = adjacency.begin() + offsets[v];
+			auto end = begin + remaining[v];
+
+			std::iter_swap(std::find(begin, end, t), end - 1);
+			remaining[v]--;
+		}
+
+		// The triangle's vertices move to the front, pushing out the rest
+		next_cache.assign(triangle, triangle + 3);
+		for (uint32_t v : cache) {
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+				next_cache.push_back(v);
+		}
+
+		for (size_t i = 0; i < next_cache.size(); i++) {
+			uint32_t v = next_cache[i];
+
+			position[v] = (i < cache_size) ? int32_t(i) : -1;
+			vertex_score[v] = score(position[v], remaining[v]);
+		}
+
+		if (next_cache.size() > cache_size)
+			next_cache.resize(cache_size);
+
+		std::swap(cache, next_cache);
+
+		// Pick the best triangle still around the cached vertices
+		best = ~0u;
+		float best_score = 0.0f;
+
+		for (uint32_t v : cache) {
+			for (uint32_t i = 0; i < remaining[v]; i++) {
+				uint32_t candidate = adjacency[offsets[v] + i];
+
+				float candidate_score = vertex_score[indices[3 * candidate + 0]]
+					+ vertex_score[indices[3 * candidate + 1]]
+					+ vertex_score[indices[3 * candidate + 2]];
+
+				if (candidate_score > best_score) {
+					best = candidate;
+					best_score = candidate_score;
+				}
+			}
+		}
+	}
+
+	indices = std::move(result);
+}
+
+// Splits the cache ordered triangles into clusters wherever a triangle
+// misses on every vertex, where reordering costs little, then draws the
+// clusters that face away from the center first; these tend to occlude
+// the rest of the mesh from most viewpoints (after Sander et al.)
+inline void optimize_overdraw(Mesh &mesh)
+{
+	constexpr size_t cache_size = 16;
+
+	auto &indices = mesh.indices;
+
+	size_t triangle_count = indices.size() / 3;
+	if (triangle_count == 0)
+		return;
+
+	// Simulated FIFO cache, by the time each vertex was last loaded
+	std::vector <size_t> loaded(mesh.vertices.size(), 0);
+	size_t time = cache_size + 1;
+
+	std::vector <size_t> clusters;
+
+	for (size_t t = 0; t < triangle_count; t++) {
+		uint32_t misses = 0;
+		for (uint32_t k = 0; k < 3; k++) {
+			uint32_t v = indices[3 * t + k];
+			if (time - loaded[v] > cache_size) {
+				loaded[v] = time++;
+				misses++;
+			}
+		}
+
+		if (t == 0 || misses == 3)
+			clusters.push_back(t);
+	}
+
+	clusters.push_back(triangle_count);
+
+	auto position = [&](size_t t, uint32_t k) {
+		return mesh.vertices[indices[3 * t + k]].position;
+	};
+
+	// Area weighted centroid of the whole mesh, then of each cluster
+	glm::vec3 center = glm::vec3(0.0f);
+	float total = 0.0f;
+
+	std::vector <glm::vec3> centroids(clusters.size() - 1, glm::vec3(0.0f));
+	std::vector <glm::vec3> normals(clusters.size() - 1, glm::vec3(0.0f));
+	std::vector <float> areas(clusters.size() - 1, 0.0f);
+
+	for (size_t c = 0; c + 1 < clusters.size(); c++) {
+		for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+			glm::vec3 p0 = position(t, 0);
+			glm::vec3 p1 = position(t, 1);
+			glm::vec3 p2 = position(t, 2);
+
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(normal);
+
+			centroids[c] += area * (p0 + p1 + p2) / 3.0f;
+			normals[c] += normal;
+			areas[c] += area;
+		}
+
+		center += centroids[c];
+		total += areas[c];
+	}
+
+	if (total > 0.0f)
+		center /= total;
+
+	std::vector <float> metric(clusters.size() - 1, 0.0f);
+	for (size_t c = 0; c < metric.size(); c++) {
+		if (areas[c] <= 0.0f)
+			continue;
+
+		glm::vec3 centroid = centroids[c] / areas[c];
+		float length = glm::length(normals[c]);
+
+		if (length > 0.0f)
+			metric[c] = glm::dot(centroid - center, normals[c] / length);
+	}
+
+	std::vector <size_t> order(metric.size());
+	std::iota(order.begin(), order.end(), 0);
+
+	std::stable_sort(order.begin(), order.end(),
+		[&](size_t a, size_t b) {
+			return metric[a] > metric[b];
+		});
+
+	std::vector <uint32_t> result;
+	result.reserve(indices.size());
+
+	for (size_t c : order) {
+		result.insert(result.end(),
+			indices.begin() + 3 * clusters[c],
+			indices.begin() + 3 * clusters[c + 1]);
+	}
+
+	indices = std::move(result);
+}
+
+// Renumbers vertices in the order the triangles first use them, which
+// also drops any vertex no triangle uses
+inline void optimize_vertex_fetch(Mesh &mesh)
+{
+	std::vector <uint32_t> remap(mesh.vertices.size(), ~0u);
+	std::vector <Vertex> ordered;
+	ordered.reserve(mesh.vertices.size());
+
+	for (uint32_t &index : mesh.indices) {
+		if (remap[index] == ~0u) {
+			remap[index] = ordered.size();
+			ordered.push_back(mesh.vertices[index]);
+		}
+
+		index = remap[index];
+	}
+
+	mesh.vertices = std::move(ordered);
+}
+
+inline void optimize_mesh(Mesh &mesh)
+{
+	weld_vertices(mesh);
+	optimize_vertex_cache(mesh);
+	optimize_overdraw(mesh);
+	optimize_vertex_fetch(mesh);
+}
+
+// Meshes are independent, so each one is optimized on its own task
+inline Model optimize_model(Model model, oak::ThreadPool &pool)
+{
+	std::vector <std::future <void>> pending;
+
+	for (auto &mesh : model)
+		pending.push_back(pool.submit([&mesh]() { optimize_mesh(mesh); }));
+
+	for (auto &future : pending)
+		future.get();
+
+	return model;
+}
@@ -91,7 +91,7 @@ int main()
 			.with_format(vk::Format::eD32Sfloat)
 			.with_samples(vk::SampleCountFlagBits::e1)
 			.with_load_operation(vk::AttachmentLoadOp::eClear)
-			.with_store_operation(vk::AttachmentStoreOp::eStore)
+			.with_store_operation(vk::AttachmentStoreOp::eDontCare)
 			.done()
 		.add_reference_collection()
 			.with_reference(0, vk::ImageLayout::eColorAttachmentOptimal)
@@ -109,7 +109,8 @@ int main()
 		.with_format(vk::Format::eD32Sfloat)
 		.with_size(window.extent())
 		.with_usage(vk::ImageUsageFlagBits::eDepthStencilAttachment)
-		.with_aspect(vk::ImageAspectFlagBits::eDepth);
+		.with_aspect(vk::ImageAspectFlagBits::eDepth)
+		.with_transient(true);
 
 	auto db = oak::Image::from(device, db_config);
 
@@ -174,11 +175,15 @@ int main()
 
 	auto pipeline = compile_pipeline(device, render_pass, config);
 
-	// Cube mesh buffers
-	auto vb = oak::Buffer::from(device, vertices, vk::BufferUsageFlagBits::eVertexBuffer);
+	// Cube mesh buffers; the vertices change every frame, so they are
+	// streamed through a transient ring partitioned per frame in flight
 	auto ib = oak::Buffer::from(device, triangles, vk::BufferUsageFlagBits::eIndexBuffer);
 
-	device.name(vb, "Vertex Buffer");
+	auto transient = oak::TransientRing::from(device,
+		window.images.size(),
+		vertices.size() * sizeof(vertices[0]),
+		vk::BufferUsageFlagBits::eVertexBuffer);
+
 	device.name(ib, "Index Buffer");
 
 	// View data
@@ -238,9 +243,20 @@ int main()
 
                 MVP push_constants { model, view, proj };
 
+                // Pulse the face colors
+                float pulse = 0.75f + 0.25f * std::sin((float) glfwGetTime() * glm::radians(180.0f));
+
+                auto shaded = vertices;
+                for (auto &vertex : shaded) {
+                        for (uint32_t i = 3; i < 6; i++)
+                                vertex[i] *= pulse;
+                }
+
+                auto stream = transient.push(shaded);
+
                 cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline.handle);
                 cmd.pushConstants <MVP> (pipeline.layout, vk::ShaderStageFlagBits::eVertex, 0, push_constants);
-                cmd.bindVertexBuffers(0, vb.handle, { 0 });
+                cmd.bindVertexBuffers(0, stream.buffer, { stream.offset });
                 cmd.bindIndexBuffer(ib.handle, 0, vk::IndexType::eUint32);
                 cmd.drawIndexed(triangles.size(), 1, 0, 0, 0);
 
@@ -248,11 +264,22 @@ int main()
 	};
 
 	auto resize = [&]() {
+		for (auto &framebuffer : framebuffers)
+			device.destroyFramebuffer(framebuffer);
+
 		framebuffers.clear();
 
+		// Depth buffer follows the swapchain extent
+		db.destroy(device);
+		db = oak::Image::from(device, db_config.with_size(window.extent()));
+
 		for (auto &view : window.views) {
+			std::array <vk::ImageView, 2> views;
+			views[0] = view;
+			views[1] = db.view;
+
 			auto fb_info = vk::FramebufferCreateInfo()
-				.setAttachments(view)
+				.setAttachments(views)
 				.setWidth(window.width)
 				.setHeight(window.height)
 				.setLayers(1)
@@ -262,8 +289,12 @@ int main()
 		}
 	};
 
-	oak::primary_render_loop(device, resources, window, render, resize);
+	oak::primary_render_loop(device, resources, window, render, resize, std::nullopt, &transient);
 
 	device.waitIdle();
+	device.savePipelineCache();
+	device.pipeline_registry->destroy();
+	device.pipeline_cache->destroy();
+	transient.destroy(device);
 	window.destroy(device);
 }
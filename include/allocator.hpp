@@ -0,0 +1,145 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <mutex>
+
+#include <vulkan/vulkan.hpp>
+
+namespace oak {
+
+// Handle to a region of device memory owned by the allocator
+struct Allocation {
+	vk::DeviceMemory memory = nullptr;
+	vk::DeviceSize offset = 0;
+	vk::DeviceSize size = 0;
+	vk::MemoryPropertyFlags flags;
+	uint32_t type = 0;
+	uint32_t pool = 0;
+	uint32_t block = 0;
+	uint32_t node = 0;
+
+	bool valid() const {
+		return memory != nullptr;
+	}
+
+	bool coherent() const {
+		return bool(flags & vk::MemoryPropertyFlagBits::eHostCoherent);
+	}
+};
+
+// Bytes handed out to resources and held in device memory blocks
+struct MemoryUsage {
+	vk::DeviceSize live = 0;
+	vk::DeviceSize peak = 0;
+	vk::DeviceSize reserved = 0;
+	uint32_t allocations = 0;
+	uint32_t blocks = 0;
+};
+
+struct MemoryStats {
+	struct Heap : MemoryUsage {
+		vk::DeviceSize size = 0;
+
+		// Process-wide values from VK_EXT_memory_budget when available,
+		// otherwise estimated from the heap size and our own blocks
+		vk::DeviceSize budget = 0;
+		vk::DeviceSize usage = 0;
+	};
+
+	std::vector <MemoryUsage> types;
+	std::vector <Heap> heaps;
+};
+
+// Sub-allocating arena over large per memory type blocks; each block
+// is managed with a two level segregated fit (TLSF) free list, so both
+// allocation and release are constant time
+class MemoryAllocator {
+	// Minimum allocation granularity; every offset is a multiple of this
+	static constexpr vk::DeviceSize granularity = 256;
+	static constexpr uint32_t fl_shift = 8;
+	static constexpr uint32_t fl_count = 32;
+	static constexpr uint32_t sl_log2 = 4;
+	static constexpr uint32_t sl_count = 1 << sl_log2;
+	static constexpr uint32_t null = ~0u;
+
+	struct Node {
+		vk::DeviceSize offset;
+		vk::DeviceSize size;
+		uint32_t prev_physical;
+		uint32_t next_physical;
+		uint32_t prev_free;
+		uint32_t next_free;
+		bool free;
+	};
+
+	struct Block {
+		vk::DeviceMemory memory = nullptr;
+		vk::DeviceSize size = 0;
+		vk::DeviceSize used = 0;
+		bool dedicated = false;
+
+		void *mapped = nullptr;
+		uint32_t map_count = 0;
+
+		std::vector <Node> nodes;
+		std::vector <uint32_t> recycled;
+
+		uint32_t fl_bitmap = 0;
+		std::array <uint32_t, fl_count> sl_bitmap {};
+		std::array <std::array <uint32_t, sl_count>, fl_count> heads;
+
+		Block(const vk::DeviceMemory &, vk::DeviceSize, bool);
+
+		uint32_t make_node(vk::DeviceSize, vk::DeviceSize);
+
+		void insert(uint32_t);
+		void remove(uint32_t);
+
+		uint32_t search(vk::DeviceSize);
+		uint32_t allocate(vk::DeviceSize, vk::DeviceSize);
+		void release(uint32_t);
+	};
+
+	// Optimal images and everything else are kept in separate pools,
+	// which sidesteps the bufferImageGranularity restrictions
+	struct Pool {
+		std::vector <std::unique_ptr <Block>> blocks;
+		std::vector <uint32_t> vacant;
+	};
+
+	vk::PhysicalDevice phdev;
+	vk::Device device;
+	vk::PhysicalDeviceMemoryProperties properties;
+	std::vector <Pool> pools;
+	std::mutex lock;
+
+	bool budget_tracking = false;
+	MemoryStats stats;
+
+	vk::DeviceSize preferred_block_size(uint32_t) const;
+
+	void refresh_budget();
+
+	// Allocates device memory for a block, or null if the heap is full
+	vk::DeviceMemory reserve(vk::DeviceSize, uint32_t, bool);
+	void unreserve(Block &, uint32_t);
+
+	uint32_t emplace_block(Pool &, std::unique_ptr <Block> &&);
+public:
+	MemoryAllocator(const vk::PhysicalDevice &, const vk::Device &, const vk::PhysicalDeviceMemoryProperties &);
+
+	// Query heap budgets through VK_EXT_memory_budget
+	void track_budget();
+
+	// Returns an invalid allocation if the memory type cannot serve the request
+	Allocation allocate(const vk::MemoryRequirements &, uint32_t, bool, bool = true);
+	void free(const Allocation &);
+
+	MemoryStats statistics();
+
+	void *map(const Allocation &);
+	void unmap(const Allocation &);
+};
+
+} // namespace oak
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "image.hpp"
+
+namespace oak {
+
+// Render attachments (depth, MSAA color, G-buffer, ...) created together so
+// that those with disjoint lifetimes within a frame, given as inclusive
+// ranges of pass indices, alias the same memory
+struct TransientAttachments {
+	struct Entry {
+		ImageInfo info;
+		uint32_t first;
+		uint32_t last;
+	};
+
+	std::vector <Entry> entries;
+	std::vector <Image> images;
+	std::vector <Allocation> slots;
+
+	// Defaults to living through the whole frame
+	uint32_t add(const ImageInfo &, uint32_t = 0, uint32_t = ~0u);
+
+	void build(const Device &);
+
+	void destroy(const Device &);
+
+	// Recreates every attachment at a new size, e.g. after a swapchain resize
+	void resize(const Device &, const vk::Extent2D &);
+
+	const Image &operator[](uint32_t index) const {
+		return images[index];
+	}
+};
+
+} // namespace oak
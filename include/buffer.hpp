@@ -1,24 +1,36 @@
 #pragma once
 
+#include <span>
+
 #include <vulkan/vulkan.hpp>
 
+#include <howler/howler.hpp>
+
 #include "device.hpp"
 
 namespace oak {
 
 struct Buffer {
-	// TODO: wrapper around memory with origin
 	vk::Buffer handle = nullptr;
-	vk::DeviceMemory memory = nullptr;
+	Allocation memory;
 	size_t size = 0;
 
+	// Only set for persistently mapped buffers
+	void *mapped = nullptr;
+
+	// Concurrently owned by every queue family in use
+	bool shared = false;
+
 	bool valid() const {
 		return (handle != nullptr) && (size != 0);
 	}
 
 	void destroy(const Device &device) const {
+		if (mapped)
+			device.unmap(memory);
+
 		device.destroyBuffer(handle);
-		device.freeMemory(memory);
+		device.release(memory);
 	}
 
 	// TODO: offset and size overloads
@@ -29,109 +41,183 @@ struct Buffer {
 			.setOffset(0);
 	}
 
+	// Persistent mapping; the pointer stays valid until the buffer is destroyed
+	Buffer &persist(const Device &device) {
+		if (!mapped)
+			mapped = device.map(memory);
+
+		return *this;
+	}
+
+	template <typename T>
+	std::span <T> view(size_t offset = 0) const {
+		howl_assert(mapped, "buffer views require a persistently mapped buffer");
+		howl_assert(offset <= size, "buffer view offset is out of bounds");
+		return std::span <T> ((T *) ((int8_t *) mapped + offset), (size - offset) / sizeof(T));
+	}
+
+	// Memory range (relative to the underlying memory) covering a
+	// section of this buffer, padded to the non-coherent atom size
+	std::optional <vk::MappedMemoryRange> range(const Device &device, size_t offset = 0, size_t length = VK_WHOLE_SIZE) const {
+		if (memory.coherent())
+			return std::nullopt;
+
+		if (length == VK_WHOLE_SIZE)
+			length = size - offset;
+
+		vk::DeviceSize atom = device.properties.limits.nonCoherentAtomSize;
+		vk::DeviceSize begin = memory.offset + offset;
+		vk::DeviceSize end = begin + length;
+
+		begin = begin & ~(atom - 1);
+		end = std::min((end + atom - 1) & ~(atom - 1), memory.offset + memory.size);
+
+		return vk::MappedMemoryRange()
+			.setMemory(memory.memory)
+			.setOffset(begin)
+			.setSize(end - begin);
+	}
+
+	void flush(const Device &device, size_t offset = 0, size_t length = VK_WHOLE_SIZE) const {
+		if (auto r = range(device, offset, length))
+			device.flushMappedMemoryRanges(r.value());
+	}
+
+	void invalidate(const Device &device, size_t offset = 0, size_t length = VK_WHOLE_SIZE) const {
+		if (auto r = range(device, offset, length))
+			device.invalidateMappedMemoryRanges(r.value());
+	}
+
+	void write(const Device &device, const void *data, size_t length, size_t offset = 0) const {
+		howl_assert(offset + length <= size, "buffer write of {} bytes at offset {} exceeds size {}", length, offset, size);
+
+		if (mapped) {
+			std::memcpy((int8_t *) mapped + offset, data, length);
+			flush(device, offset, length);
+			return;
+		}
+
+		int8_t *pointer = (int8_t *) device.map(memory);
+		std::memcpy(pointer + offset, data, length);
+		flush(device, offset, length);
+		device.unmap(memory);
+	}
+
+	void read(const Device &device, void *data, size_t length, size_t offset = 0) const {
+		howl_assert(offset + length <= size, "buffer read of {} bytes at offset {} exceeds size {}", length, offset, size);
+
+		if (mapped) {
+			invalidate(device, offset, length);
+			std::memcpy(data, (int8_t *) mapped + offset, length);
+			return;
+		}
+
+		int8_t *pointer = (int8_t *) device.map(memory);
+		invalidate(device, offset, length);
+		std::memcpy(data, pointer + offset, length);
+		device.unmap(memory);
+	}
+
 	template <typename T>
 	void upload(const Device &device, const std::vector <T> &data, size_t offset = 0) const {
-		int8_t *mapped = (int8_t *) device.mapMemory(memory, 0, size);
-		std::memcpy(mapped + offset, data.data(), data.size() * sizeof(T));
-		device.unmapMemory(memory);
+		write(device, data.data(), data.size() * sizeof(T), offset);
 	}
 
 	template <typename T>
 	void upload(const Device &device, const T &data, size_t offset = 0) const {
-		int8_t *mapped = (int8_t *) device.mapMemory(memory, 0, size);
-		std::memcpy(mapped + offset, &data, sizeof(T));
-		device.unmapMemory(memory);
+		write(device, &data, sizeof(T), offset);
 	}
 
 	template <typename T>
-	void upload(const Device &device, const T *data, size_t size, size_t offset = 0) const {
-		int8_t *mapped = (int8_t *) device.mapMemory(memory, 0, size);
-		std::memcpy(mapped + offset, data, size);
-		device.unmapMemory(memory);
+	void upload(const Device &device, const T *data, size_t length, size_t offset = 0) const {
+		write(device, data, length, offset);
 	}
 
 	template <typename T>
 	void download(const Device &device, std::vector <T> &data) const {
-		// TODO: size check...
-		void *mapped = device.mapMemory(memory, 0, size);
-		std::memcpy(data.data(), mapped, data.size() * sizeof(T));
-		device.unmapMemory(memory);
+		read(device, data.data(), data.size() * sizeof(T));
 	}
 
 	template <typename T>
 	static Buffer from(const Device &device, const std::vector <T> &data, const vk::BufferUsageFlags &usage) {
-		Buffer buffer;
-
-		buffer.size = sizeof(T) * data.size();
-
-		auto buffer_info = vk::BufferCreateInfo()
-			.setSize(buffer.size)
-			.setUsage(usage);
-
-		buffer.handle = device.createBuffer(buffer_info);
+		Buffer buffer = from(device, sizeof(T) * data.size(), usage);
+		buffer.upload(device, data);
+		return buffer;
+	}
 
-		auto memory_requirements = device.getBufferMemoryRequirements(buffer.handle);
+	template <typename T>
+	static Buffer from(const Device &device, const T &data, const vk::BufferUsageFlags &usage) {
+		Buffer buffer = from(device, sizeof(T), usage);
+		buffer.upload(device, data);
+		return buffer;
+	}
 
-		buffer.memory = device.allocateMemoryRequirements(memory_requirements,
+	static Buffer from(const Device &device, size_t size, const vk::BufferUsageFlags &usage) {
+		return from(device, size, usage,
 			vk::MemoryPropertyFlagBits::eHostCoherent
 			| vk::MemoryPropertyFlagBits::eHostVisible);
-
-		device.bindBufferMemory(buffer.handle, buffer.memory, 0);
-
-		void *mapped = device.mapMemory(buffer.memory, 0, memory_requirements.size);
-		std::memcpy(mapped, data.data(), buffer.size);
-		device.unmapMemory(buffer.memory);
-
-		return buffer;
 	}
 
-	template <typename T>
-	static Buffer from(const Device &device, const T &data, const vk::BufferUsageFlags &usage) {
+	static Buffer from(const Device &device,
+			   size_t size,
+			   const vk::BufferUsageFlags &usage,
+			   const vk::MemoryPropertyFlags &properties,
+			   const vk::MemoryPropertyFlags &preferred = {},
+			   bool shared = false) {
 		Buffer buffer;
 
-		buffer.size = sizeof(T);
+		buffer.size = size;
 
 		auto buffer_info = vk::BufferCreateInfo()
 			.setSize(buffer.size)
 			.setUsage(usage);
 
+		// Only buffers filled on the transfer queue and read on another
+		// are shared, which spares them ownership transfers; the rest
+		// stay exclusive to keep full speed access
+		auto families = device.queueFamilies();
+		if (shared && families.size() > 1) {
+			buffer_info.setSharingMode(vk::SharingMode::eConcurrent)
+				.setQueueFamilyIndices(families);
+
+			buffer.shared = true;
+		}
+
 		buffer.handle = device.createBuffer(buffer_info);
 
 		auto memory_requirements = device.getBufferMemoryRequirements(buffer.handle);
 
-		buffer.memory = device.allocateMemoryRequirements(memory_requirements,
-			vk::MemoryPropertyFlagBits::eHostCoherent
-			| vk::MemoryPropertyFlagBits::eHostVisible);
-
-		device.bindBufferMemory(buffer.handle, buffer.memory, 0);
+		buffer.memory = device.allocate(memory_requirements, properties, preferred);
 
-		void *mapped = device.mapMemory(buffer.memory, 0, memory_requirements.size);
-		std::memcpy(mapped, &data, buffer.size);
-		device.unmapMemory(buffer.memory);
+		device.bindBufferMemory(buffer.handle, buffer.memory.memory, buffer.memory.offset);
 
 		return buffer;
 	}
+};
 
-	static Buffer from(const Device &device, size_t size, const vk::BufferUsageFlags &usage) {
-		Buffer buffer;
-
-		buffer.size = size;
+// Batches flushes and invalidations of non-coherent memory into single calls
+struct MappedRanges {
+	std::vector <vk::MappedMemoryRange> ranges;
 
-		auto buffer_info = vk::BufferCreateInfo()
-			.setSize(buffer.size)
-			.setUsage(usage);
+	MappedRanges &add(const Device &device, const Buffer &buffer, size_t offset = 0, size_t length = VK_WHOLE_SIZE) {
+		if (auto r = buffer.range(device, offset, length))
+			ranges.push_back(r.value());
 
-		buffer.handle = device.createBuffer(buffer_info);
+		return *this;
+	}
 
-		auto memory_requirements = device.getBufferMemoryRequirements(buffer.handle);
+	void flush(const Device &device) {
+		if (ranges.size())
+			device.flushMappedMemoryRanges(ranges);
 
-		buffer.memory = device.allocateMemoryRequirements(memory_requirements,
-			vk::MemoryPropertyFlagBits::eHostCoherent
-			| vk::MemoryPropertyFlagBits::eHostVisible);
+		ranges.clear();
+	}
 
-		device.bindBufferMemory(buffer.handle, buffer.memory, 0);
+	void invalidate(const Device &device) {
+		if (ranges.size())
+			device.invalidateMappedMemoryRanges(ranges);
 
-		return buffer;
+		ranges.clear();
 	}
 };
 
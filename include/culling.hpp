@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+
+#include "buffer.hpp"
+#include "geometry-pool.hpp"
+#include "staging.hpp"
+
+namespace oak {
+
+// Frustum culling on the GPU: a compute pass tests the bounding sphere of
+// every command in an indirect buffer against the camera frustum, and
+// compacts the visible commands of each batch to the start of that batch's
+// range, counting them for drawIndexedIndirectCount. Outputs are kept per
+// frame in flight, so a frame culls while earlier ones are still drawing
+struct GpuCulling {
+	static constexpr uint32_t group_size = 64;
+
+	// Matches the shader's std430 layout; base is the first command of
+	// the draw's batch, in both the input and the output buffers
+	struct Bounds {
+		float center[3];
+		float radius;
+		uint32_t batch;
+		uint32_t base;
+		uint32_t padding[2];
+	};
+
+	// World space planes, with normals pointing inwards
+	struct Frustum {
+		std::array <std::array <float, 4>, 6> planes;
+		uint32_t draw_count;
+	};
+
+	vk::Pipeline pipeline;
+	vk::PipelineLayout layout;
+	vk::DescriptorSetLayout dsl;
+	vk::DescriptorPool descriptor_pool;
+
+	std::vector <vk::DescriptorSet> descriptors;
+
+	Buffer bounds;
+	std::vector <Buffer> visible;
+	std::vector <Buffer> counts;
+
+	uint32_t draw_count = 0;
+	uint32_t batch_count = 0;
+
+	// Whether the device can draw with counts read from a buffer
+	static bool supported(const Device &);
+
+	// Clears the counts and culls every command; outside a render pass
+	void dispatch(const vk::CommandBuffer &, uint32_t, const float *) const;
+
+	// Draws the visible commands of a batch, by its position in the batches
+	void draw(const vk::CommandBuffer &, uint32_t, const GeometryPool &, const DrawBatch &, uint32_t) const;
+
+	void destroy(const Device &) const;
+
+	// Culls the given indirect commands, one bounding sphere per command
+	static GpuCulling from(const Device &,
+			       StagingUploader &,
+			       const vk::ShaderModule &,
+			       const Buffer &,
+			       const std::vector <Bounds> &,
+			       uint32_t,
+			       uint32_t);
+
+	// Planes of a column major view projection matrix, clip space in
+	// -w to w on every axis (Gribb and Hartmann)
+	static Frustum frustum(const float *);
+};
+
+} // namespace oak
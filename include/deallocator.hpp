@@ -36,6 +36,10 @@ class Deallocator {
 
 	std::queue <Unit> queued;
 
+	// Sub-allocations are returned after every handle is destroyed
+	std::vector <Allocation> allocations;
+	std::vector <Allocation> mappings;
+
 	Unit pop();
 public:
 	Deallocator(const Device &);
@@ -56,6 +60,8 @@ public:
 	collector(vk::DescriptorPool);
 	collector(vk::CommandPool);
 
+	collector(Allocation);
+
 	collector(Image);
 	collector(Buffer);
 	collector(PrimarySynchronization);
@@ -1,12 +1,27 @@
 #pragma once
 
 #include "device.hpp"
+#include "timeline.hpp"
 
 namespace oak {
 
 struct DeviceResources {
 	Queue queue;
 	vk::CommandPool command_pool;
+
+	// Async compute and transfer queues; each has its own pool so that
+	// background work is recorded independently of the graphics queue
+	Queue compute_queue;
+	vk::CommandPool compute_pool;
+
+	Queue transfer_queue;
+	vk::CommandPool transfer_pool;
+
+	// Submission timelines for each of the queues above
+	GpuTimeline timeline;
+	GpuTimeline compute_timeline;
+	GpuTimeline transfer_timeline;
+
 	vk::DescriptorPool descriptor_pool;
 
 	static DeviceResources from(const Device &device);
@@ -2,6 +2,9 @@
 
 #include <vulkan/vulkan.hpp>
 
+#include "allocator.hpp"
+#include "pipeline-cache.hpp"
+#include "pipeline-registry.hpp"
 #include "queue.hpp"
 
 namespace oak {
@@ -13,23 +16,73 @@ struct Buffer;
 
 struct Device : public vk::PhysicalDevice, public vk::Device {
 	vk::PhysicalDeviceMemoryProperties memory_properties;
+	std::shared_ptr <MemoryAllocator> allocator;
+
+	// Submission locks of the device's queues
+	std::shared_ptr <QueueLocks> queue_locks;
+
+	// Shared by every pipeline created on the device, persisted to disk
+	std::shared_ptr <PipelineCache> pipeline_cache;
+
+	// Deduplicated pipelines and layouts, shared by every copy
+	std::shared_ptr <PipelineRegistry> pipeline_registry;
 
 	struct Properties {
+		vk::PhysicalDeviceLimits limits;
 		vk::PhysicalDeviceRayTracingPipelinePropertiesKHR rtx_pipeline;
+
+		// Layouts images may be in for host image copies
+		std::vector <vk::ImageLayout> copy_src_layouts;
+		std::vector <vk::ImageLayout> copy_dst_layouts;
 	} properties;
 
 	struct Features {
 		bool raytracing = false;
+		bool memory_budget = false;
+		bool host_image_copy = false;
+		bool multi_draw_indirect = false;
+		bool draw_indirect_count = false;
+		bool graphics_pipeline_library = false;
+
+		// Raster state pipelines may leave dynamic: cull mode, topology
+		// and depth test and write, then polygon mode and blend enables
+		bool dynamic_state = false;
+		bool dynamic_polygon_mode = false;
+		bool dynamic_blend_enable = false;
 	} icx_features;
 
+	// Where each kind of work is submitted; compute and transfer share
+	// the graphics queue when the device has no better family for them
+	struct QueueSlot {
+		uint32_t family = 0;
+		uint32_t index = 0;
+	};
+
+	struct Queues {
+		QueueSlot graphics;
+		QueueSlot compute;
+		QueueSlot transfer;
+	} queues;
+
 	Device() = default;
 	Device(const vk::PhysicalDevice &, const vk::Device &);
 
 	// Methods
 	Queue getQueue(uint32_t, uint32_t) const;
+	Queue getQueue(const QueueSlot &) const;
+
+	// Distinct families with created queues
+	std::vector <uint32_t> queueFamilies() const;
 
 	vk::CommandPool createCommandPool(const Queue &) const;
 
+	// Null when the device was created without a pipeline cache
+	vk::PipelineCache pipelineCache() const;
+
+	// Writes the pipeline cache back to disk, after background pipeline
+	// links have finished
+	void savePipelineCache() const;
+
 	void waitAndReset(const vk::Fence &) const;
 
 	vk::DeviceAddress getAddress(const vk::Buffer &) const;
@@ -75,9 +128,17 @@ struct Device : public vk::PhysicalDevice, public vk::Device {
 		vk::CommandBufferLevel level
 	) const -> std::vector <vk::CommandBuffer>;
 
+	// Memory types satisfying the required flags, best match first
+	auto rankMemoryTypes(
+		uint32_t filter,
+		const vk::MemoryPropertyFlags &required,
+		const vk::MemoryPropertyFlags &preferred = {}
+	) const -> std::vector <uint32_t>;
+
 	auto findMemoryType(
 		uint32_t filter,
-		const vk::MemoryPropertyFlags &properties
+		const vk::MemoryPropertyFlags &properties,
+		const vk::MemoryPropertyFlags &preferred = {}
 	) const -> uint32_t;
 
 	auto allocateMemoryRequirements(
@@ -85,6 +146,21 @@ struct Device : public vk::PhysicalDevice, public vk::Device {
 		const vk::MemoryPropertyFlags &properties
 	) const -> vk::DeviceMemory;
 
+	// Sub-allocation through the memory allocator
+	auto allocate(
+		const vk::MemoryRequirements &requirements,
+		const vk::MemoryPropertyFlags &properties,
+		const vk::MemoryPropertyFlags &preferred = {},
+		bool linear = true
+	) const -> Allocation;
+
+	void release(const Allocation &) const;
+
+	void *map(const Allocation &) const;
+	void unmap(const Allocation &) const;
+
+	MemoryStats memoryStats() const;
+
 	// Creation
 	static Device create(bool = false);
 };
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstring>
+#include <unordered_map>
+
+#include <vulkan/vulkan.hpp>
+
+namespace oak {
+
+// State a draw binds before it is issued; null handles are left unbound
+struct DrawState {
+	vk::Pipeline pipeline = nullptr;
+	vk::PipelineLayout layout = nullptr;
+	vk::DescriptorSet descriptors = nullptr;
+	vk::Buffer vertex_buffer = nullptr;
+	vk::Buffer index_buffer = nullptr;
+	vk::IndexType index_type = vk::IndexType::eUint32;
+	vk::ShaderStageFlags push_stages = vk::ShaderStageFlagBits::eVertex;
+};
+
+// Binds recorded against those elided because the state was already bound
+struct DrawStats {
+	struct Counter {
+		uint32_t issued = 0;
+		uint32_t skipped = 0;
+	};
+
+	uint32_t draws = 0;
+
+	Counter pipelines;
+	Counter descriptors;
+	Counter vertex_buffers;
+	Counter index_buffers;
+	Counter push_constants;
+};
+
+// Draws gathered over a frame, each with a sort key made of its pipeline,
+// descriptor set, vertex buffer and depth, from most to least significant.
+// Recording radix sorts the keys, so that draws sharing state are adjacent
+// and nearest first among those, then skips every bind that matches what
+// is already bound
+struct DrawList {
+	struct Draw {
+		DrawState state;
+
+		// Push constants, as a range of the constants array
+		uint32_t constants_offset = 0;
+		uint32_t constants_size = 0;
+
+		// Direct draws issue the command itself, indirect ones read
+		// count commands from the buffer instead, or as many as the
+		// count buffer holds when one is given
+		vk::DrawIndexedIndirectCommand command;
+		vk::Buffer indirect = nullptr;
+		vk::DeviceSize offset = 0;
+		uint32_t count = 0;
+
+		vk::Buffer count_buffer = nullptr;
+		vk::DeviceSize count_offset = 0;
+	};
+
+	// Key layout, from the top bit down; distinct states beyond a
+	// field's range share identifiers, which only costs ordering
+	static constexpr uint32_t pipeline_bits = 10;
+	static constexpr uint32_t descriptor_bits = 16;
+	static constexpr uint32_t vertex_buffer_bits = 10;
+	static constexpr uint32_t depth_bits = 28;
+
+	std::vector <Draw> draws;
+	std::vector <uint64_t> keys;
+	std::vector <uint8_t> constants;
+
+	// Dense identifiers for the key fields, in order of first appearance
+	std::unordered_map <VkPipeline, uint64_t> pipeline_ids;
+	std::unordered_map <VkDescriptorSet, uint64_t> descriptor_ids;
+	std::unordered_map <VkBuffer, uint64_t> vertex_buffer_ids;
+
+	// Sorting scratch, kept across frames
+	std::vector <uint64_t> sorted_keys;
+	std::vector <uint32_t> order;
+	std::vector <uint64_t> scratch_keys;
+	std::vector <uint32_t> scratch_order;
+
+	// Commands per indirect draw call, one without multiDrawIndirect
+	uint32_t max_draws = 1;
+
+	// Counters of the last recording
+	DrawStats stats;
+
+	// Adds a draw with its key; the caller fills in the command
+	Draw &emplace(const DrawState &, float, const void *, uint32_t);
+
+	template <typename T>
+	void add(const DrawState &state, float depth, const T &push, const vk::DrawIndexedIndirectCommand &command) {
+		emplace(state, depth, &push, sizeof(T)).command = command;
+	}
+
+	template <typename T>
+	void add(const DrawState &state, float depth, const T &push, const vk::Buffer &indirect, vk::DeviceSize offset, uint32_t count) {
+		auto &draw = emplace(state, depth, &push, sizeof(T));
+		draw.indirect = indirect;
+		draw.offset = offset;
+		draw.count = count;
+	}
+
+	template <typename T>
+	void add(const DrawState &state, float depth, const T &push,
+		 const vk::Buffer &indirect, vk::DeviceSize offset,
+		 const vk::Buffer &count_buffer, vk::DeviceSize count_offset, uint32_t max_count) {
+		auto &draw = emplace(state, depth, &push, sizeof(T));
+		draw.indirect = indirect;
+		draw.offset = offset;
+		draw.count = max_count;
+		draw.count_buffer = count_buffer;
+		draw.count_offset = count_offset;
+	}
+
+	// Sorts and records every draw, then clears the list
+	void record(const vk::CommandBuffer &);
+
+	void clear();
+
+	// Least significant digit radix sort of keys, carrying their indices
+	static void radix_sort(std::vector <uint64_t> &, std::vector <uint32_t> &,
+			       std::vector <uint64_t> &, std::vector <uint32_t> &);
+};
+
+} // namespace oak
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <optional>
+
+#include "buffer.hpp"
+#include "staging.hpp"
+
+namespace oak {
+
+// Shared vertex and index buffers that meshes are sub-allocated from, so
+// that a whole model binds its geometry once and is drawn indirectly; each
+// index type has its own buffer, and free space in every buffer is a list
+// of element ranges sorted by offset, allocated first fit and coalesced
+// when released
+struct GeometryPool {
+	struct Range {
+		uint32_t offset;
+		uint32_t count;
+	};
+
+	struct Arena {
+		Buffer buffer;
+		uint32_t stride = 0;
+		std::vector <Range> free;
+
+		std::optional <uint32_t> allocate(uint32_t);
+		void release(uint32_t, uint32_t);
+	};
+
+	// A mesh's place in the pool; indices are relative to its first vertex
+	struct Geometry {
+		uint32_t first_vertex = 0;
+		uint32_t vertex_count = 0;
+		uint32_t first_index = 0;
+		uint32_t index_count = 0;
+		vk::IndexType index_type = vk::IndexType::eUint32;
+	};
+
+	Arena vertices;
+	Arena indices16;
+	Arena indices32;
+
+	// Commands per indirect draw call, one without multiDrawIndirect
+	uint32_t max_draws = 1;
+
+	Arena &indices(vk::IndexType);
+	const Arena &indices(vk::IndexType) const;
+
+	// Reserves space for a mesh, or nothing if either buffer is full
+	std::optional <Geometry> allocate(uint32_t, uint32_t, vk::IndexType);
+	void free(const Geometry &);
+
+	// Allocates a mesh and stages its vertices and indices for upload
+	std::optional <Geometry> add(StagingUploader &, const void *, uint32_t, const void *, uint32_t, vk::IndexType);
+
+	// Binds the vertex buffer; index buffers are bound with each batch
+	void bind(const vk::CommandBuffer &) const;
+
+	void destroy(const Device &) const;
+
+	static GeometryPool from(const Device &, uint32_t, uint32_t, uint32_t, uint32_t);
+};
+
+// Consecutive commands of an indirect buffer that draw with the same state
+struct DrawBatch {
+	uint64_t key;
+	vk::IndexType index_type;
+	uint32_t first;
+	uint32_t count;
+};
+
+// Gathers draws of pool geometry into an array of indexed indirect
+// commands, grouped into one batch per key and index type; the key
+// stands for whatever state the draws share, such as their pipeline
+// and material, and each batch records as a single indirect draw
+struct IndirectDrawBuilder {
+	struct Draw {
+		uint64_t key;
+		vk::IndexType index_type;
+		vk::DrawIndexedIndirectCommand command;
+	};
+
+	std::vector <Draw> draws;
+
+	void add(uint64_t, const GeometryPool::Geometry &, uint32_t = 1, uint32_t = 0);
+
+	// Batches ordered by key; draws keep the order they were added in.
+	// Optionally gives, for each command, the draw it was added as
+	void build(std::vector <vk::DrawIndexedIndirectCommand> &, std::vector <DrawBatch> &,
+		   std::vector <uint32_t> * = nullptr) const;
+
+	void clear() {
+		draws.clear();
+	}
+
+	// Records a batch of commands from the indirect buffer
+	static void draw(const vk::CommandBuffer &, const GeometryPool &, const Buffer &, const DrawBatch &);
+};
+
+} // namespace oak
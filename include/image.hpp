@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+#include <bit>
 #include <filesystem>
 
 #include <vulkan/vulkan.hpp>
@@ -9,11 +11,23 @@
 namespace oak {
 
 struct Buffer;
+struct DeviceResources;
+struct StagingUploader;
+
+// Tightly packed texels on the host, levels from largest to smallest
+struct Texture {
+	uint32_t width;
+	uint32_t height;
+	vk::Format format;
+	uint32_t mip_levels = 1;
+	std::vector <uint8_t> data;
+};
 
 struct DepthImageInfo {
 	vk::Format format;
 	vk::Extent2D size;
-	vk::SampleCountFlagBits samples;
+	vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+	bool transient = false;
 
 	// TODO: check for valid formats...
 	DepthImageInfo &with_format(const vk::Format &format_) {
@@ -30,6 +44,11 @@ struct DepthImageInfo {
 		samples = samples_;
 		return *this;
 	}
+
+	DepthImageInfo &with_transient(bool transient_) {
+		transient = transient_;
+		return *this;
+	}
 };
 
 struct ImageInfo {
@@ -37,7 +56,15 @@ struct ImageInfo {
 	vk::Extent2D size;
 	vk::ImageUsageFlags usage;
 	vk::ImageAspectFlags aspect;
-	vk::SampleCountFlagBits samples;
+	vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+
+	// Attachments whose contents never leave the render pass
+	bool transient = false;
+
+	// Filled on the transfer queue, so owned by every queue family
+	bool shared = false;
+
+	uint32_t mip_levels = 1;
 
 	ImageInfo &with_format(const vk::Format &format_) {
 		format = format_;
@@ -63,22 +90,99 @@ struct ImageInfo {
 		samples = samples_;
 		return *this;
 	}
+
+	ImageInfo &with_transient(bool transient_) {
+		transient = transient_;
+		return *this;
+	}
+
+	ImageInfo &with_shared(bool shared_) {
+		shared = shared_;
+		return *this;
+	}
+
+	// Zero requests the full chain down to a single texel
+	ImageInfo &with_mip_levels(uint32_t mip_levels_ = 0) {
+		mip_levels = mip_levels_;
+		return *this;
+	}
+
+	uint32_t levels() const {
+		uint32_t full = std::bit_width(std::max(size.width, size.height));
+		return (mip_levels == 0) ? full : std::min(mip_levels, full);
+	}
 };
 
 struct Image {
 	vk::Image handle;
 	vk::ImageView view;
-	vk::DeviceMemory memory;
+	Allocation memory;
 	vk::Format format;
 	vk::Extent2D size;
+	vk::ImageAspectFlags aspect;
+	uint32_t mip_levels = 1;
+
+	// Created with host transfer usage, for VK_EXT_host_image_copy
+	bool host_transfer = false;
+
+	// Concurrently owned by every queue family in use
+	bool shared = false;
 
 	void destroy(const Device &);
 
+	size_t bytes() const;
+
+	// Bytes over every level
+	size_t footprint() const;
+
+	static size_t bytes(const vk::Format &, const vk::Extent2D &);
+
+	// Bytes of a range of levels in a chain with the given base extent
+	static size_t bytes(const vk::Format &, const vk::Extent2D &, uint32_t, uint32_t);
+
+	// Copies the first level into a buffer; the stage and access mask of
+	// the image's last writer make its contents visible to the copy
+	void download(const vk::CommandBuffer &,
+		const Buffer &,
+		const vk::ImageLayout &,
+		const vk::PipelineStageFlags & = vk::PipelineStageFlagBits::eTopOfPipe,
+		const vk::PipelineStageFlags & = vk::PipelineStageFlagBits::eBottomOfPipe,
+		const vk::AccessFlags & = vk::AccessFlagBits::eNone) const;
+
 	void download(const vk::CommandBuffer &,
 		const Buffer &,
+		size_t,
 		const vk::ImageLayout &,
 		const vk::PipelineStageFlags & = vk::PipelineStageFlagBits::eTopOfPipe,
-		const vk::PipelineStageFlags & = vk::PipelineStageFlagBits::eBottomOfPipe);
+		const vk::PipelineStageFlags & = vk::PipelineStageFlagBits::eBottomOfPipe,
+		const vk::AccessFlags & = vk::AccessFlagBits::eNone) const;
+
+	// Fills the image and leaves it in the given layout; copies straight
+	// from host memory when possible, otherwise the copy is staged and
+	// completes with the uploader's next submission
+	void upload(const Device &,
+		StagingUploader &,
+		const void *,
+		size_t,
+		const vk::ImageLayout & = vk::ImageLayout::eShaderReadOnlyOptimal) const;
+
+	void upload(const Device &,
+		StagingUploader &,
+		const Texture &,
+		const vk::ImageLayout & = vk::ImageLayout::eShaderReadOnlyOptimal) const;
+
+	// Blits each level down from the one above; every level must be in
+	// the transfer destination layout, with the base level filled in
+	void generate_mips(const Device &,
+		const vk::CommandBuffer &,
+		const vk::ImageLayout & = vk::ImageLayout::eShaderReadOnlyOptimal) const;
+
+	// Reads back the image, which must be idle in the given layout
+	std::vector <uint8_t> download(const Device &, const DeviceResources &, const vk::ImageLayout &) const;
+
+	// Two step creation, for images placed in externally managed memory
+	static Image unbound(const Device &, const ImageInfo &);
+	void bind(const Device &, const Allocation &, const ImageInfo &);
 
 	static Image from(const Device &, const ImageInfo &);
 	static Image from(const Device &, const DepthImageInfo &);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+
+#include "image.hpp"
+#include "thread-pool.hpp"
+
+namespace oak {
+
+// KTX2 containers; block compressed payloads are used as they are, while
+// Basis Universal payloads (ETC1S or UASTC) are transcoded to BC1, BC5 or
+// BC7 depending on their channels, which requires building with OAK_BASISU
+struct KTX2 {
+	// Layout of the fixed size header and index, see the KTX2 specification
+	struct Header {
+		uint8_t identifier[12];
+		uint32_t vk_format;
+		uint32_t type_size;
+		uint32_t width;
+		uint32_t height;
+		uint32_t depth;
+		uint32_t layers;
+		uint32_t faces;
+		uint32_t levels;
+		uint32_t supercompression;
+
+		uint32_t dfd_offset;
+		uint32_t dfd_length;
+		uint32_t kvd_offset;
+		uint32_t kvd_length;
+		uint64_t sgd_offset;
+		uint64_t sgd_length;
+	};
+
+	struct Level {
+		uint64_t offset;
+		uint64_t length;
+		uint64_t uncompressed_length;
+	};
+
+	enum Supercompression : uint32_t {
+		eNone = 0,
+		eBasisLZ = 1,
+		eZstandard = 2,
+		eZLIB = 3,
+	};
+
+	static constexpr uint8_t identifier[12] {
+		0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'
+	};
+
+	static bool valid(const std::filesystem::path &);
+
+	static std::optional <Texture> load(const Device &, const std::filesystem::path &);
+
+	// Parses a file already in memory, the path only names it in errors
+	static std::optional <Texture> load(const Device &, const std::vector <uint8_t> &, const std::filesystem::path &);
+
+	// Loads (and transcodes) the files as tasks on the worker pool and
+	// waits for them, so it must not be called from one of the pool's tasks
+	static std::vector <std::optional <Texture>> load(const Device &, ThreadPool &, const std::vector <std::filesystem::path> &);
+};
+
+} // namespace oak
@@ -1,15 +1,32 @@
 #pragma once
 
+#include "allocator.hpp"
+#include "attachments.hpp"
+#include "culling.hpp"
 #include "buffer.hpp"
 #include "deallocator.hpp"
 #include "device-resources.hpp"
 #include "device.hpp"
+#include "draw-list.hpp"
+#include "geometry-pool.hpp"
 #include "globals.hpp"
 #include "image.hpp"
+#include "ktx2.hpp"
+#include "pipeline-batch.hpp"
+#include "pipeline-cache.hpp"
+#include "pipeline-library.hpp"
+#include "pipeline-registry.hpp"
 #include "pipeline.hpp"
+#include "readback.hpp"
 #include "render-loop.hpp"
 #include "render-pass.hpp"
+#include "residency.hpp"
 #include "spirv.hpp"
+#include "staging.hpp"
 #include "sync.hpp"
+#include "texture-loader.hpp"
+#include "thread-pool.hpp"
+#include "timeline.hpp"
+#include "transient.hpp"
 #include "util.hpp"
 #include "window.hpp"
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <future>
+
+#include "pipeline.hpp"
+#include "sbt.hpp"
+#include "thread-pool.hpp"
+
+namespace oak {
+
+// Compiling many pipelines at once, one task per pipeline on the worker
+// pool; every task goes through the device's pipeline cache, which the
+// driver synchronizes internally. Results are ready as their futures are,
+// and the device must outlive them
+template <vertex_type Vertex, typename Vconst = void, typename Fconst = void>
+auto compile_pipelines(ThreadPool &pool,
+		       const Device &device,
+		       const vk::RenderPass &render_pass,
+		       const std::vector <RasterPipelineInfo <Vertex, Vconst, Fconst>> &configs)
+-> std::vector <std::future <RasterPipeline <Vconst, Fconst>>>
+{
+	std::vector <std::future <RasterPipeline <Vconst, Fconst>>> result;
+	result.reserve(configs.size());
+
+	for (const auto &config : configs) {
+		result.emplace_back(pool.submit([&device, render_pass, config]() {
+			return compile_pipeline(device, render_pass, config);
+		}));
+	}
+
+	return result;
+}
+
+auto compile_pipelines(ThreadPool &,
+		       const Device &,
+		       const std::vector <RaytracingPipeline> &,
+		       const vk::PipelineLayout &)
+-> std::vector <std::future <std::tuple <vk::Pipeline, ShaderBindingTable>>>;
+
+} // namespace oak
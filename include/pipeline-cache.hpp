@@ -0,0 +1,46 @@
+#pragma once
+
+#include <filesystem>
+
+#include <vulkan/vulkan.hpp>
+
+namespace oak {
+
+// Pipeline cache persisted across runs. The blob on disk is prefixed with
+// the device it came from; a blob from another device, driver version or
+// cache UUID, or one that fails its checksum, is dropped and the cache
+// starts out empty. Saving writes a temporary file and renames it over the
+// old one, so an interrupted save never leaves a truncated cache behind
+struct PipelineCache {
+	static constexpr uint32_t magic = 0x504B414F; // "OAKP"
+	static constexpr uint32_t version = 1;
+
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t vendor;
+		uint32_t device;
+		uint32_t driver;
+		uint8_t uuid[VK_UUID_SIZE];
+		uint64_t size;
+		uint64_t checksum;
+	};
+
+	vk::Device device;
+	vk::PipelineCache handle;
+	std::filesystem::path path;
+	Header identity {};
+
+	// Writes the current contents back to the file
+	bool save() const;
+
+	void destroy() const;
+
+	// Default location: $OAK_PIPELINE_CACHE, otherwise under the XDG cache
+	// directory, otherwise next to the working directory
+	static std::filesystem::path default_path();
+
+	static PipelineCache load(const vk::PhysicalDevice &, const vk::Device &, const std::filesystem::path &);
+};
+
+} // namespace oak
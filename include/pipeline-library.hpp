@@ -0,0 +1,23 @@
+#pragma once
+
+#include <future>
+
+#include "device.hpp"
+
+namespace oak {
+
+// Pipeline assembled from graphics pipeline libraries. The vertex input,
+// pre-rasterization, fragment shader and fragment output parts are each a
+// library obtained through the registry, so a part shared by several
+// pipelines is compiled once, and the parts are fast linked together. A
+// link with link time optimization runs on the registry's worker, and its
+// pipeline replaces the fast linked one once ready
+struct LinkedPipeline {
+	vk::Pipeline handle;
+	std::shared_future <vk::Pipeline> optimized;
+};
+
+// Takes the same description as a monolithic pipeline
+LinkedPipeline link_pipeline(const Device &, const vk::GraphicsPipelineCreateInfo &);
+
+} // namespace oak
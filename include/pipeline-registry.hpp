@@ -0,0 +1,70 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include <vulkan/vulkan.hpp>
+
+#include "thread-pool.hpp"
+
+namespace oak {
+
+// Pipelines and layouts keyed by their whole creation state, so
+// that identical state is created once and handed out again on every later
+// request. Since equal layouts are one handle, descriptor sets and push
+// constants bound for one pipeline stay valid for any other created from
+// the same description. Shader modules are identified by handle and render
+// passes by handle and subpass, so both must outlive the registry. The
+// registry owns everything it hands out and is safe to use from several
+// threads; handles created by two threads at once for the same state are
+// resolved to whichever was registered first
+struct PipelineRegistry {
+	struct Stats {
+		uint32_t hits = 0;
+		uint32_t misses = 0;
+	};
+
+	vk::Device device;
+
+	std::mutex lock;
+	std::unordered_map <std::string, vk::DescriptorSetLayout> set_layouts;
+	std::unordered_map <std::string, vk::PipelineLayout> layouts;
+	std::unordered_map <std::string, vk::Pipeline> pipelines;
+
+	Stats stats;
+
+	// Background work on the registry, such as optimized pipeline links;
+	// declared last so that it is joined before the rest is torn down
+	std::unique_ptr <ThreadPool> linker;
+
+	PipelineRegistry(const vk::Device &device_) : device(device_) {}
+
+	PipelineRegistry(const PipelineRegistry &) = delete;
+	PipelineRegistry &operator=(const PipelineRegistry &) = delete;
+
+	vk::DescriptorSetLayout descriptorSetLayout(const vk::DescriptorSetLayoutCreateInfo &);
+	vk::PipelineLayout pipelineLayout(const vk::PipelineLayoutCreateInfo &);
+	vk::Pipeline graphicsPipeline(const vk::PipelineCache &, const vk::GraphicsPipelineCreateInfo &);
+
+	// Registered pipeline for the state, without creating one
+	std::optional <vk::Pipeline> find(const vk::GraphicsPipelineCreateInfo &);
+
+	// Single worker, started on first use
+	ThreadPool &worker();
+
+	// Waits for background work, such as links still in flight
+	void join();
+
+	// Waits for background work first
+	void destroy();
+
+	// Serialized creation state, compared whole on lookup
+	static std::string key(const vk::DescriptorSetLayoutCreateInfo &);
+	static std::string key(const vk::PipelineLayoutCreateInfo &);
+	static std::string key(const vk::GraphicsPipelineCreateInfo &);
+};
+
+} // namespace oak
@@ -1,11 +1,15 @@
 #pragma once
 
+#include <chrono>
+#include <future>
+
 #include <vulkan/vulkan.hpp>
 
 #include <howler/howler.hpp>
 #include <vulkan/vulkan_enums.hpp>
 
 #include "device.hpp"
+#include "pipeline-library.hpp"
 #include "spirv.hpp"
 
 namespace oak {
@@ -16,6 +20,18 @@ concept vertex_type = std::same_as <V, void> || requires() {
 	{ V::attributes() } -> std::same_as <std::vector <vk::VertexInputAttributeDescription>>;
 };
 
+// Raster state a pipeline leaves to be set while recording, through the
+// setters of RasterPipeline; whatever the device cannot make dynamic is
+// baked in from the pipeline info as usual
+struct RasterDynamicState {
+	bool cull = false;
+	bool fill = false;
+	bool depth_test = false;
+	bool depth_write = false;
+	bool topology = false;
+	bool blend = false;
+};
+
 template <typename Vconst = void, typename Fconst = void>
 struct RasterPipeline {
 	using RVconst = std::conditional_t <std::same_as <Vconst, void>, int, Vconst>;
@@ -25,6 +41,28 @@ struct RasterPipeline {
 	vk::PipelineLayout layout;
 	std::optional <vk::DescriptorSetLayout> dsl;
 
+	// States that actually ended up dynamic
+	RasterDynamicState dynamic;
+
+	// Optimized pipeline still being linked, for pipelines built from
+	// graphics pipeline libraries
+	std::shared_future <vk::Pipeline> optimized;
+
+	// Swaps in the optimized pipeline once it is ready; the handle it
+	// replaces stays valid, so commands in flight are unaffected
+	bool poll() {
+		if (!optimized.valid())
+			return false;
+
+		if (optimized.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return false;
+
+		handle = optimized.get();
+		optimized = {};
+
+		return true;
+	}
+
 	// TODO: bind returns another handle?
 	void bind(const vk::CommandBuffer &cmd) const {
 		cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, handle);
@@ -43,6 +81,39 @@ struct RasterPipeline {
 
 		cmd.pushConstants <Fconst> (layout, vk::ShaderStageFlagBits::eFragment, offset, fconst);
 	}
+
+	// Dynamic state, which persists across binds of pipelines that
+	// leave the same state dynamic
+	void setCullMode(const vk::CommandBuffer &cmd, const vk::CullModeFlags &cull) const {
+		howl_assert(dynamic.cull, "cull mode is not dynamic in this pipeline");
+		cmd.setCullModeEXT(cull);
+	}
+
+	void setPolygonMode(const vk::CommandBuffer &cmd, const vk::PolygonMode &fill) const {
+		howl_assert(dynamic.fill, "polygon mode is not dynamic in this pipeline");
+		cmd.setPolygonModeEXT(fill);
+	}
+
+	void setDepthTest(const vk::CommandBuffer &cmd, bool enable) const {
+		howl_assert(dynamic.depth_test, "depth test is not dynamic in this pipeline");
+		cmd.setDepthTestEnableEXT(enable);
+	}
+
+	void setDepthWrite(const vk::CommandBuffer &cmd, bool enable) const {
+		howl_assert(dynamic.depth_write, "depth write is not dynamic in this pipeline");
+		cmd.setDepthWriteEnableEXT(enable);
+	}
+
+	// Only within the topology class the pipeline was created with
+	void setTopology(const vk::CommandBuffer &cmd, const vk::PrimitiveTopology &topology) const {
+		howl_assert(dynamic.topology, "topology is not dynamic in this pipeline");
+		cmd.setPrimitiveTopologyEXT(topology);
+	}
+
+	void setBlendEnable(const vk::CommandBuffer &cmd, uint32_t attachment, bool enable) const {
+		howl_assert(dynamic.blend, "blending is not dynamic in this pipeline");
+		cmd.setColorBlendEnableEXT(attachment, vk::Bool32(enable));
+	}
 };
 
 template <vertex_type Vertex, typename Vconst = void, typename Fconst = void>
@@ -55,8 +126,12 @@ struct RasterPipelineInfo {
 	std::vector <bool> attachments;
 	bool depth_write;
 	bool depth_test;
+	vk::CullModeFlags cull;
+	vk::PrimitiveTopology topology;
+	RasterDynamicState dynamic;
 
-	RasterPipelineInfo() : fill(vk::PolygonMode::eFill), depth_write(false), depth_test(false) {}
+	RasterPipelineInfo() : fill(vk::PolygonMode::eFill), depth_write(false), depth_test(false),
+			cull(vk::CullModeFlagBits::eNone), topology(vk::PrimitiveTopology::eTriangleList) {}
 
 	auto &with_bindings(const std::vector <vk::DescriptorSetLayoutBinding> &bindings_) {
 		bindings = bindings_;
@@ -99,8 +174,27 @@ struct RasterPipelineInfo {
 		samples = samples_;
 		return *this;
 	}
+
+	auto &with_cull(const vk::CullModeFlags &cull_) {
+		cull = cull_;
+		return *this;
+	}
+
+	auto &with_topology(const vk::PrimitiveTopology &topology_) {
+		topology = topology_;
+		return *this;
+	}
+
+	auto &with_dynamic(const RasterDynamicState &dynamic_) {
+		dynamic = dynamic_;
+		return *this;
+	}
 };
 
+// Handles come from the device's pipeline registry, so identical
+// configurations share their pipeline and layouts, which the registry owns.
+// With graphics pipeline libraries the pipeline is fast linked from its
+// parts, and poll() later swaps in the optimized link
 template <vertex_type Vertex, typename Vconst = void, typename Fconst = void>
 RasterPipeline <Vconst, Fconst> compile_pipeline(const Device &device,
 						 const vk::RenderPass &render_pass,
@@ -164,7 +258,7 @@ RasterPipeline <Vconst, Fconst> compile_pipeline(const Device &device,
 			.setBindings(config.bindings)
 			.setPNext(&binding_info);
 
-		result.dsl = device.createDescriptorSetLayout(dsl_info);
+		result.dsl = device.pipeline_registry->descriptorSetLayout(dsl_info);
 	}
 
 	// Pipeline layout
@@ -174,7 +268,7 @@ RasterPipeline <Vconst, Fconst> compile_pipeline(const Device &device,
 	if (result.dsl)
 		layout_info = layout_info.setSetLayouts(result.dsl.value());
 
-	result.layout = device.createPipelineLayout(layout_info);
+	result.layout = device.pipeline_registry->pipelineLayout(layout_info);
 
 	// Rest of the pipeline configuration
 	auto vertex_input_state_info = vk::PipelineVertexInputStateCreateInfo()
@@ -197,21 +291,59 @@ RasterPipeline <Vconst, Fconst> compile_pipeline(const Device &device,
 
 	auto input_assembly_info = vk::PipelineInputAssemblyStateCreateInfo()
 		.setPrimitiveRestartEnable(vk::False)
-		.setTopology(vk::PrimitiveTopology::eTriangleList);
+		.setTopology(config.topology);
 
 	auto raster_state_info = vk::PipelineRasterizationStateCreateInfo()
-		.setCullMode(vk::CullModeFlagBits::eNone)
+		.setCullMode(config.cull)
 		.setPolygonMode(config.fill)
 		.setFrontFace(vk::FrontFace::eCounterClockwise)
 		.setRasterizerDiscardEnable(vk::False)
 		.setDepthBiasEnable(vk::False)
 		.setLineWidth(1);
 
-	std::vector <vk::DynamicState> dynamic_states;
+	// Dynamic states, as far as the device allows
+	auto &features = device.icx_features;
+
+	auto &dynamic = result.dynamic;
+	dynamic.cull = config.dynamic.cull && features.dynamic_state;
+	dynamic.depth_test = config.dynamic.depth_test && features.dynamic_state;
+	dynamic.depth_write = config.dynamic.depth_write && features.dynamic_state;
+	dynamic.topology = config.dynamic.topology && features.dynamic_state;
+	dynamic.fill = config.dynamic.fill && features.dynamic_polygon_mode;
+	dynamic.blend = config.dynamic.blend && features.dynamic_blend_enable;
+
+	bool missing = (config.dynamic.cull && !dynamic.cull)
+		|| (config.dynamic.depth_test && !dynamic.depth_test)
+		|| (config.dynamic.depth_write && !dynamic.depth_write)
+		|| (config.dynamic.topology && !dynamic.topology)
+		|| (config.dynamic.fill && !dynamic.fill)
+		|| (config.dynamic.blend && !dynamic.blend);
+
+	if (missing)
+		howl_warning("some requested dynamic states are unsupported and stay baked into the pipeline");
+
+	std::vector <vk::DynamicState> dynamic_states {
+		vk::DynamicState::eViewport,
+		vk::DynamicState::eScissor,
+	};
+
+	if (dynamic.cull)
+		dynamic_states.push_back(vk::DynamicState::eCullModeEXT);
+
+	if (dynamic.depth_test)
+		dynamic_states.push_back(vk::DynamicState::eDepthTestEnableEXT);
 
-	dynamic_states.resize(2);
-	dynamic_states[0] = vk::DynamicState::eViewport;
-	dynamic_states[1] = vk::DynamicState::eScissor;
+	if (dynamic.depth_write)
+		dynamic_states.push_back(vk::DynamicState::eDepthWriteEnableEXT);
+
+	if (dynamic.topology)
+		dynamic_states.push_back(vk::DynamicState::ePrimitiveTopologyEXT);
+
+	if (dynamic.fill)
+		dynamic_states.push_back(vk::DynamicState::ePolygonModeEXT);
+
+	if (dynamic.blend)
+		dynamic_states.push_back(vk::DynamicState::eColorBlendEnableEXT);
 
 	auto dynamic_state_info = vk::PipelineDynamicStateCreateInfo()
 		.setDynamicStates(dynamic_states);
@@ -273,7 +405,13 @@ RasterPipeline <Vconst, Fconst> compile_pipeline(const Device &device,
 		.setPViewportState(&viewport_state_info)
 		.setRenderPass(render_pass);
 
-	result.handle = device.createGraphicsPipelines({}, pipeline_info).value.front();
+	if (device.icx_features.graphics_pipeline_library) {
+		auto linked = link_pipeline(device, pipeline_info);
+		result.handle = linked.handle;
+		result.optimized = linked.optimized;
+	} else {
+		result.handle = device.pipeline_registry->graphicsPipeline(device.pipelineCache(), pipeline_info);
+	}
 
 	return result;
 }
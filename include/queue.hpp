@@ -1,5 +1,9 @@
 #pragma once
 
+#include <map>
+#include <memory>
+#include <mutex>
+
 #include <vulkan/vulkan.hpp>
 
 namespace oak {
@@ -10,21 +14,34 @@ enum SwapchainStatus {
 		eFaulty
 };
 
+// Vulkan queues must be externally synchronized, and several timelines or
+// roles may share one; there is a single lock for each queue handle
+struct QueueLocks {
+	std::mutex mutex;
+	std::map <VkQueue, std::shared_ptr <std::mutex>> locks;
+
+	std::shared_ptr <std::mutex> get(const vk::Queue &);
+};
+
 struct Queue : vk::Queue {
 	uint32_t family;
 	uint32_t index;
 
+	// Shared by every Queue of the same handle, if from the device
+	std::shared_ptr <std::mutex> lock;
+
 	Queue() = default;
 	Queue(const vk::Queue &);
 
+	// Held while submitting or presenting
+	std::unique_lock <std::mutex> acquire() const;
+
 	void submit(const std::vector <vk::CommandBuffer> &,
 		const std::vector <vk::Semaphore> &,
 		const std::vector <vk::Semaphore> &,
 		const vk::Fence &,
 		const vk::PipelineStageFlags &) const;
 
-	void submitAndWait(const std::vector <vk::CommandBuffer> &) const;
-
 	SwapchainStatus present(const vk::SwapchainKHR &,
 				const std::vector <vk::Semaphore> &,
 				uint32_t) const;
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "buffer.hpp"
+#include "image.hpp"
+#include "timeline.hpp"
+
+namespace oak {
+
+// Pending device to host copy, readable once its timeline point has been
+// reached; valid until the ring partition it lives in is reclaimed
+struct Readback {
+	Buffer buffer;
+	size_t offset = 0;
+	size_t size = 0;
+
+	GpuTimeline timeline;
+	uint64_t point = 0;
+
+	bool ready(const Device &) const;
+
+	void wait(const Device &) const;
+
+	// Waits for the copy, then invalidates just this region
+	template <typename T>
+	std::span <const T> data(const Device &device) const {
+		wait(device);
+		buffer.invalidate(device, offset, size);
+		return std::span <const T> ((const T *) ((int8_t *) buffer.mapped + offset), size / sizeof(T));
+	}
+};
+
+// Host cached readback memory split into one partition per frame in flight,
+// so the results of frame N can be consumed while later frames render
+struct ReadbackRing {
+	Buffer buffer;
+	size_t frames = 0;
+	size_t partition = 0;
+
+	uint32_t frame = 0;
+	size_t cursor = 0;
+
+	GpuTimeline timeline;
+	uint64_t point = 0;
+
+	// Starts recording into a retired frame's partition; the point
+	// must be the one the frame's submission will signal
+	void reclaim(uint32_t, const GpuTimeline &, uint64_t);
+
+	Readback download(const vk::CommandBuffer &, const Buffer &, size_t, size_t);
+
+	Readback download(const vk::CommandBuffer &,
+		const Image &,
+		const vk::ImageLayout &,
+		const vk::PipelineStageFlags & = vk::PipelineStageFlagBits::eTopOfPipe,
+		const vk::PipelineStageFlags & = vk::PipelineStageFlagBits::eBottomOfPipe,
+		const vk::AccessFlags & = vk::AccessFlagBits::eNone);
+
+	void destroy(const Device &) const;
+
+	static ReadbackRing from(const Device &, size_t, size_t);
+};
+
+} // namespace oak
@@ -9,6 +9,10 @@
 
 namespace oak {
 
+// Forward declarations
+struct TransientRing;
+struct ReadbackRing;
+
 using Renderer = std::function <void (const vk::CommandBuffer &, uint32_t)>;
 using Resizer = std::function <void ()>;
 using AfterPresent = std::function <void ()>;
@@ -24,6 +28,9 @@ struct RenderLoopBuilder {
 	std::optional <Resizer> resizer;
 	std::optional <AfterPresent> after_present;
 
+	TransientRing *transient = nullptr;
+	ReadbackRing *readback = nullptr;
+
 	RenderLoopBuilder(const Device &device_,
 			  const DeviceResources &resources_,
 			  Deallocator &deallocator_,
@@ -48,6 +55,16 @@ struct RenderLoopBuilder {
 		return *this;
 	}
 
+	RenderLoopBuilder &with_transient(TransientRing &transient_) {
+		transient = &transient_;
+		return *this;
+	}
+
+	RenderLoopBuilder &with_readback(ReadbackRing &readback_) {
+		readback = &readback_;
+		return *this;
+	}
+
 	void launch();
 };
 
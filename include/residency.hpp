@@ -0,0 +1,46 @@
+#pragma once
+
+#include "texture-loader.hpp"
+
+namespace oak {
+
+// Keeps loaded textures within a device memory budget. Every frame the
+// renderer reports which textures it samples and how many pixels they
+// cover; update streams each one towards the level that coverage needs,
+// and while over budget evicts the least recently sampled textures,
+// then drops the finest levels of those still in use
+struct TextureResidency {
+	using Handle = TextureLoader::Handle;
+
+	TextureLoader &loader;
+	size_t budget;
+
+	uint64_t frame = 1;
+	bool exceeded = false;
+
+	struct Usage {
+		uint64_t last_sampled = 0;
+		float pixels = 0.0f;
+	};
+
+	std::vector <Usage> usage;
+
+	TextureResidency(TextureLoader &loader_, size_t budget_)
+			: loader(loader_), budget(budget_) {}
+
+	// The texture is sampled this frame, across the given number of
+	// pixels along the larger side of its footprint on screen
+	void sample(Handle, float);
+
+	// Sets each texture's target level; call once per frame, after the
+	// samples and before polling the loader
+	void update();
+
+	// Device memory held by every texture
+	size_t used() const;
+
+	// Finest level worth keeping for the given coverage
+	static uint32_t level(const vk::Extent2D &, float);
+};
+
+} // namespace oak
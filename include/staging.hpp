@@ -0,0 +1,104 @@
+#pragma once
+
+#include "buffer.hpp"
+#include "device-resources.hpp"
+#include "image.hpp"
+
+namespace oak {
+
+// Uploads into device local memory through shared staging buffers; every
+// copy recorded since the last submission goes out in one command buffer,
+// on the transfer queue so that it can overlap with rendering. Generating
+// mips takes blits, so those images go out in one graphics queue submission
+struct StagingUploader {
+	static constexpr size_t chunk_size = 64 << 20;
+
+	const Device &device;
+	GpuTimeline timeline;
+	vk::CommandPool command_pool;
+
+	vk::CommandBuffer cmd;
+	uint64_t point = 0;
+	bool pending = false;
+
+	// Owned by the uploader, since the render loop records from the
+	// resources' graphics pool and pools are externally synchronized
+	GpuTimeline graphics_timeline;
+	vk::CommandPool graphics_pool;
+
+	vk::CommandBuffer graphics_cmd;
+	uint64_t graphics_point = 0;
+
+	// Persistently mapped staging memory, reused once the point is reached
+	std::vector <Buffer> chunks;
+	size_t chunk = 0;
+	size_t cursor = 0;
+
+	struct Copy {
+		uint32_t chunk;
+		vk::Buffer destination;
+		vk::BufferCopy region;
+	};
+
+	std::vector <Copy> copies;
+
+	struct ImageCopy {
+		uint32_t chunk;
+		Image image;
+		vk::ImageLayout layout;
+		std::vector <vk::BufferImageCopy> regions;
+		bool generate;
+	};
+
+	std::vector <ImageCopy> image_copies;
+
+	// Copies into the base levels, generating the rest of the mips
+	void record(const vk::CommandBuffer &, const std::vector <ImageCopy> &) const;
+
+	StagingUploader(const Device &, const DeviceResources &);
+
+	// Copies data into staging memory, returning the chunk and offset
+	std::pair <uint32_t, size_t> stage(const void *, size_t, size_t = 16);
+
+	void upload(const Buffer &, const void *, size_t, size_t = 0);
+
+	template <typename T>
+	void upload(const Buffer &buffer, const std::vector <T> &data, size_t offset = 0) {
+		upload(buffer, data.data(), data.size() * sizeof(T), offset);
+	}
+
+	// Fills an image from packed levels, largest first, and leaves it in
+	// the given layout; from a single level the others are generated
+	void upload(const Image &, const void *, size_t, const vk::ImageLayout &, uint32_t = 1);
+
+	template <typename T>
+	Buffer upload(const std::vector <T> &data, const vk::BufferUsageFlags &usage) {
+		auto buffer = Buffer::from(device,
+			sizeof(T) * data.size(),
+			usage | vk::BufferUsageFlagBits::eTransferDst,
+			vk::MemoryPropertyFlagBits::eDeviceLocal,
+			{ }, true);
+
+		upload(buffer, data.data(), buffer.size);
+
+		return buffer;
+	}
+
+	// Records and submits all pending copies, returning the timeline
+	// points that later submissions should depend on
+	std::vector <GpuDependency> submit();
+
+	void wait();
+
+	// Whether the last submission has retired, without blocking
+	bool ready() const;
+
+	void flush() {
+		submit();
+		wait();
+	}
+
+	void destroy();
+};
+
+} // namespace oak
@@ -2,22 +2,25 @@
 
 #include <vector>
 
-#include "device.hpp"
+#include "timeline.hpp"
 
 namespace oak {
 
+// Frames in flight retire through timeline points; the swapchain still
+// needs binary semaphores for acquisition and presentation
 struct PrimarySynchronization {
-	std::vector <vk::Fence> processing;
+	GpuTimeline timeline;
+	std::vector <uint64_t> points;
 	std::vector <vk::Semaphore> available;
 	std::vector <vk::Semaphore> finished;
 
-	static PrimarySynchronization from(const Device &device, size_t N) {
+	static PrimarySynchronization from(const Device &device, const Queue &queue, size_t N) {
 		PrimarySynchronization result;
 
-		for (size_t i = 0; i < N; i++) {
-			auto fence_info = vk::FenceCreateInfo().setFlags(vk::FenceCreateFlagBits::eSignaled);
-			result.processing.emplace_back(device.createFence(fence_info));
+		result.timeline = GpuTimeline::from(device, queue);
+		result.points.resize(N, 0);
 
+		for (size_t i = 0; i < N; i++) {
 			auto semaphore_info = vk::SemaphoreCreateInfo();
 			result.available.emplace_back(device.createSemaphore(semaphore_info));
 			result.finished.emplace_back(device.createSemaphore(semaphore_info));
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+#include "image.hpp"
+#include "staging.hpp"
+#include "thread-pool.hpp"
+
+namespace oak {
+
+// Asynchronous texture loading; files are read, hashed and decoded on the
+// thread pool while the caller keeps rendering with a placeholder. Each
+// poll uploads whatever finished decoding in one staged submission, and
+// files with identical contents share a single image, whatever their path.
+// Textures can be streamed to a coarser or finer base level, or evicted
+// entirely, by decoding the file again; see TextureResidency for a policy
+struct TextureLoader {
+	using Handle = uint32_t;
+
+	// Decodes formats other than KTX2, which is handled directly; called
+	// from the worker threads, so it must be thread safe
+	using Decoder = std::function <std::optional <Texture> (const std::vector <uint8_t> &)>;
+
+	const Device &device;
+	StagingUploader &uploader;
+	ThreadPool &pool;
+	Decoder decoder;
+
+	// Bytes of decoded texels staged per poll at most
+	size_t batch_size = StagingUploader::chunk_size;
+
+	// Images replaced while frames in flight may still sample them are
+	// destroyed this many polls later, so poll once per frame
+	uint32_t latency = 3;
+	uint64_t polls = 0;
+
+	// Opaque white, sampled until a texture is resident
+	Image placeholder;
+
+	enum class State {
+		ePending,
+		eResident,
+		eDuplicate,
+		eFailed,
+	};
+
+	// Result of a worker, either texels from the base level down or the
+	// handle sharing the contents; the extent is that of the full chain
+	struct Decoded {
+		std::optional <Texture> texture;
+		std::optional <Handle> duplicate;
+		vk::Extent2D extent;
+		uint32_t levels = 0;
+		uint32_t base = 0;
+		bool streamable = false;
+	};
+
+	struct Entry {
+		std::filesystem::path path;
+		State state = State::ePending;
+		std::optional <Handle> duplicate;
+
+		// Full chain, known once first decoded; only streamable textures
+		// can be decoded at a coarser level than the first
+		vk::Format format = vk::Format::eUndefined;
+		vk::Extent2D extent;
+		uint32_t levels = 0;
+		bool streamable = false;
+
+		// The image's first level is this level of the full chain
+		Image image;
+		uint32_t base = 0;
+
+		// Level to stream towards, where the level count means evicted,
+		// and the work in flight for it
+		uint32_t target = 0;
+		std::future <Decoded> future;
+		std::optional <Texture> texture;
+		Image incoming;
+		uint32_t incoming_base = 0;
+	};
+
+	std::vector <Entry> entries;
+	std::map <std::filesystem::path, Handle> paths;
+
+	// Files by content hash, shared with the workers; matching hashes
+	// are confirmed against the file itself before being deduplicated
+	struct Known {
+		size_t size;
+		std::filesystem::path path;
+		Handle handle;
+	};
+
+	std::mutex mutex;
+	std::unordered_multimap <uint64_t, Known> hashes;
+
+	std::vector <Handle> uploading;
+	std::vector <std::pair <uint64_t, Image>> retired;
+
+	// The placeholder goes out with the uploader's next submission
+	TextureLoader(const Device &, StagingUploader &, ThreadPool &, const Decoder & = {});
+
+	TextureLoader(const TextureLoader &) = delete;
+	TextureLoader &operator=(const TextureLoader &) = delete;
+
+	// Runs on a worker, decoding the file from the given level down
+	Decoded decode(const std::filesystem::path &, Handle, uint32_t, bool);
+
+	void start(Handle);
+	void retire(const Image &);
+
+	// Starts loading the file, unless the same path is already known
+	Handle request(const std::filesystem::path &);
+
+	// Retires the previous upload and submits the textures decoded since,
+	// never blocking; returns the handles that became resident
+	std::vector <Handle> poll();
+
+	// Moves the texture towards the given base level once known; the
+	// level count evicts it, falling back to the placeholder
+	void stream(Handle, uint32_t);
+
+	// Handle whose image the given one uses, following duplicates
+	Handle resolve(Handle) const;
+
+	bool resident(Handle) const;
+	bool failed(Handle) const;
+
+	// Loading is done, successfully or not, for every requested texture
+	bool idle() const;
+
+	// Device memory held by the texture, including uploads in flight
+	size_t bytes(Handle) const;
+
+	// Device memory the texture would take from the given base level
+	size_t bytes(Handle, uint32_t) const;
+
+	// The loaded image if resident, otherwise the placeholder
+	const Image &image(Handle) const;
+
+	// Waits for the workers and the last upload before releasing images
+	void destroy();
+};
+
+} // namespace oak
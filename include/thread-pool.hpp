@@ -0,0 +1,56 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace oak {
+
+// Fixed set of worker threads taking tasks from a shared queue; tasks
+// still queued on destruction are run before the workers are joined
+struct ThreadPool {
+	std::vector <std::thread> workers;
+	std::queue <std::function <void ()>> tasks;
+
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping = false;
+
+	ThreadPool(size_t = std::max(std::thread::hardware_concurrency(), 1u));
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	~ThreadPool();
+
+	size_t size() const {
+		return workers.size();
+	}
+
+	template <typename F>
+	auto submit(F &&function) -> std::future <std::invoke_result_t <F>> {
+		using R = std::invoke_result_t <F>;
+
+		// Packaged tasks are move only, which std::function does not allow
+		auto task = std::make_shared <std::packaged_task <R ()>> (std::forward <F> (function));
+		auto future = task->get_future();
+
+		{
+			std::lock_guard lock(mutex);
+			tasks.emplace([task]() { (*task)(); });
+		}
+
+		condition.notify_one();
+
+		return future;
+	}
+};
+
+} // namespace oak
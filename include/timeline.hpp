@@ -0,0 +1,61 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+
+#include "device.hpp"
+
+namespace oak {
+
+// Work submitted before this point must finish before the dependent
+// submission passes the given stage; binary semaphores use a zero value
+struct GpuDependency {
+	vk::Semaphore semaphore;
+	uint64_t value = 0;
+	vk::PipelineStageFlags stage = vk::PipelineStageFlagBits::eAllCommands;
+};
+
+// Submissions to one queue tracked by a timeline semaphore, each one
+// signaling the next point of a monotonically increasing counter. Copies
+// share the same counter, and submissions are serialized with any other
+// work submitted to or presented from the same queue
+struct GpuTimeline {
+	Queue queue;
+	vk::Semaphore semaphore;
+
+	struct Counter {
+		std::mutex mutex;
+		uint64_t submitted = 0;
+	};
+
+	std::shared_ptr <Counter> counter;
+
+	// Last point handed out by submit
+	uint64_t submitted() const;
+
+	// Last point the device has signaled
+	uint64_t completed(const Device &) const;
+
+	bool reached(const Device &, uint64_t) const;
+
+	// Returns false if the timeout (in nanoseconds) expired first
+	bool wait(const Device &, uint64_t, uint64_t = UINT64_MAX) const;
+
+	// Blocks until everything submitted through this timeline has retired
+	void drain(const Device &) const;
+
+	GpuDependency at(uint64_t, const vk::PipelineStageFlags & = vk::PipelineStageFlagBits::eAllCommands) const;
+
+	// Submits the commands after their dependencies, additionally
+	// signaling binary semaphores (e.g. for presentation); returns the
+	// point signaled on completion
+	uint64_t submit(const std::vector <vk::CommandBuffer> &,
+		const std::vector <GpuDependency> & = {},
+		const std::vector <vk::Semaphore> & = {}) const;
+
+	void destroy(const Device &) const;
+
+	static GpuTimeline from(const Device &, const Queue &);
+};
+
+} // namespace oak
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "buffer.hpp"
+
+namespace oak {
+
+// Short-lived region of the transient ring, valid for the current frame
+struct TransientAllocation {
+	vk::Buffer buffer;
+	size_t offset = 0;
+	size_t size = 0;
+	void *pointer = nullptr;
+
+	template <typename T>
+	T *as() const {
+		return (T *) pointer;
+	}
+
+	vk::DescriptorBufferInfo descriptor() const {
+		return vk::DescriptorBufferInfo()
+			.setBuffer(buffer)
+			.setOffset(offset)
+			.setRange(size);
+	}
+};
+
+// Linear allocator over one persistently mapped buffer, split into one
+// partition per frame in flight; a partition is reclaimed as a whole once
+// the render loop has waited on that frame's timeline point
+struct TransientRing {
+	Buffer buffer;
+	size_t frames = 0;
+	size_t partition = 0;
+	size_t alignment = 0;
+
+	size_t frame = 0;
+	size_t cursor = 0;
+
+	TransientAllocation allocate(size_t, size_t = 0);
+
+	template <typename T>
+	TransientAllocation push(const T &value) {
+		auto allocation = allocate(sizeof(T));
+		std::memcpy(allocation.pointer, &value, sizeof(T));
+		return allocation;
+	}
+
+	template <typename T>
+	TransientAllocation push(const std::vector <T> &values) {
+		auto allocation = allocate(sizeof(T) * values.size());
+		std::memcpy(allocation.pointer, values.data(), allocation.size);
+		return allocation;
+	}
+
+	// Starts allocating from the partition of a (retired) frame
+	void reclaim(uint32_t);
+
+	// Makes the current partition visible to the device
+	void flush(const Device &) const;
+
+	void destroy(const Device &) const;
+
+	static TransientRing from(const Device &, size_t, size_t,
+		const vk::BufferUsageFlags & = vk::BufferUsageFlagBits::eUniformBuffer
+			| vk::BufferUsageFlagBits::eStorageBuffer
+			| vk::BufferUsageFlagBits::eVertexBuffer
+			| vk::BufferUsageFlagBits::eIndexBuffer);
+};
+
+} // namespace oak
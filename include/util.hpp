@@ -8,6 +8,10 @@
 
 namespace oak {
 
+// Forward declarations
+struct TransientRing;
+struct ReadbackRing;
+
 // Render loop high level function
 using Renderer = std::function <void (const vk::CommandBuffer &, uint32_t)>;
 using Resizer = std::function <void ()>;
@@ -18,9 +22,11 @@ void primary_render_loop(const Device &,
 			 Window &,
 			 const Renderer &,
 			 const std::optional <Resizer> & = std::nullopt,
-			 const std::optional <AfterPresent> & = std::nullopt);
+			 const std::optional <AfterPresent> & = std::nullopt,
+			 TransientRing * = nullptr,
+			 ReadbackRing * = nullptr);
 
-// Image layout transitioning
+// Image layout transitioning, over every mip level by default
 void transition(const vk::CommandBuffer &,
 		const vk::Image &,
 		const vk::ImageAspectFlagBits &,
@@ -29,6 +35,8 @@ void transition(const vk::CommandBuffer &,
 		const vk::AccessFlags &,
 		const vk::AccessFlags &,
 		const vk::PipelineStageFlags &,
-		const vk::PipelineStageFlags &);
+		const vk::PipelineStageFlags &,
+		uint32_t = 0,
+		uint32_t = VK_REMAINING_MIP_LEVELS);
 
 } // namespace oak
@@ -0,0 +1,496 @@
+#include <bit>
+
+#include <howler/howler.hpp>
+
+#include "allocator.hpp"
+
+namespace oak {
+
+static vk::DeviceSize align_up(vk::DeviceSize x, vk::DeviceSize a)
+{
+	return (x + a - 1) & ~(a - 1);
+}
+
+// TLSF block methods
+MemoryAllocator::Block::Block(const vk::DeviceMemory &memory_, vk::DeviceSize size_, bool dedicated_)
+		: memory(memory_), size(size_), dedicated(dedicated_)
+{
+	for (auto &list : heads)
+		list.fill(null);
+
+	uint32_t root = make_node(0, size);
+
+	// Dedicated blocks hold exactly one allocation
+	if (dedicated) {
+		nodes[root].free = false;
+		used = size;
+	} else {
+		insert(root);
+	}
+}
+
+uint32_t MemoryAllocator::Block::make_node(vk::DeviceSize offset, vk::DeviceSize length)
+{
+	auto node = Node {
+		offset, length,
+		null, null,
+		null, null,
+		false
+	};
+
+	if (recycled.size()) {
+		uint32_t index = recycled.back();
+		recycled.pop_back();
+		nodes[index] = node;
+		return index;
+	}
+
+	nodes.push_back(node);
+	return nodes.size() - 1;
+}
+
+static void mapping(vk::DeviceSize size, uint32_t sl_log2, uint32_t fl_shift, uint32_t &fl, uint32_t &sl)
+{
+	uint32_t bit = std::bit_width(size) - 1;
+	sl = (size >> (bit - sl_log2)) ^ (1u << sl_log2);
+	fl = bit - fl_shift;
+}
+
+void MemoryAllocator::Block::insert(uint32_t index)
+{
+	uint32_t fl;
+	uint32_t sl;
+	mapping(nodes[index].size, sl_log2, fl_shift, fl, sl);
+
+	uint32_t head = heads[fl][sl];
+
+	nodes[index].free = true;
+	nodes[index].prev_free = null;
+	nodes[index].next_free = head;
+
+	if (head != null)
+		nodes[head].prev_free = index;
+
+	heads[fl][sl] = index;
+	fl_bitmap |= (1u << fl);
+	sl_bitmap[fl] |= (1u << sl);
+}
+
+void MemoryAllocator::Block::remove(uint32_t index)
+{
+	uint32_t fl;
+	uint32_t sl;
+	mapping(nodes[index].size, sl_log2, fl_shift, fl, sl);
+
+	uint32_t prev = nodes[index].prev_free;
+	uint32_t next = nodes[index].next_free;
+
+	if (prev != null)
+		nodes[prev].next_free = next;
+	if (next != null)
+		nodes[next].prev_free = prev;
+
+	if (heads[fl][sl] == index) {
+		heads[fl][sl] = next;
+
+		if (next == null) {
+			sl_bitmap[fl] &= ~(1u << sl);
+			if (!sl_bitmap[fl])
+				fl_bitmap &= ~(1u << fl);
+		}
+	}
+
+	nodes[index].free = false;
+}
+
+uint32_t MemoryAllocator::Block::search(vk::DeviceSize length)
+{
+	// Round up so that any node in the resulting list is large enough
+	length += (vk::DeviceSize(1) << (std::bit_width(length) - 1 - sl_log2)) - 1;
+
+	uint32_t fl;
+	uint32_t sl;
+	mapping(length, sl_log2, fl_shift, fl, sl);
+
+	if (fl >= fl_count)
+		return null;
+
+	uint32_t sl_map = sl_bitmap[fl] & (~0u << sl);
+	if (!sl_map) {
+		uint32_t fl_map = (fl + 1 < fl_count) ? fl_bitmap & (~0u << (fl + 1)) : 0;
+		if (!fl_map)
+			return null;
+
+		fl = std::countr_zero(fl_map);
+		sl_map = sl_bitmap[fl];
+	}
+
+	sl = std::countr_zero(sl_map);
+
+	return heads[fl][sl];
+}
+
+uint32_t MemoryAllocator::Block::allocate(vk::DeviceSize length, vk::DeviceSize alignment)
+{
+	// Offsets are always multiples of the granularity, so
+	// only larger alignments can require padding
+	vk::DeviceSize padding = (alignment > granularity) ? alignment - granularity : 0;
+
+	uint32_t index = search(length + padding);
+	if (index == null)
+		return null;
+
+	remove(index);
+
+	// Give back the leading space skipped for alignment
+	vk::DeviceSize offset = nodes[index].offset;
+	vk::DeviceSize aligned = align_up(offset, std::max(alignment, granularity));
+
+	if (aligned > offset) {
+		uint32_t front = make_node(offset, aligned - offset);
+		uint32_t prev = nodes[index].prev_physical;
+
+		nodes[front].prev_physical = prev;
+		nodes[front].next_physical = index;
+		if (prev != null)
+			nodes[prev].next_physical = front;
+
+		nodes[index].prev_physical = front;
+		nodes[index].offset = aligned;
+		nodes[index].size -= aligned - offset;
+
+		insert(front);
+	}
+
+	// Give back the trailing space
+	if (nodes[index].size - length >= granularity) {
+		uint32_t back = make_node(nodes[index].offset + length, nodes[index].size - length);
+		uint32_t next = nodes[index].next_physical;
+
+		nodes[back].prev_physical = index;
+		nodes[back].next_physical = next;
+		if (next != null)
+			nodes[next].prev_physical = back;
+
+		nodes[index].next_physical = back;
+		nodes[index].size = length;
+
+		insert(back);
+	}
+
+	used += nodes[index].size;
+
+	return index;
+}
+
+void MemoryAllocator::Block::release(uint32_t index)
+{
+	used -= nodes[index].size;
+
+	// Coalesce with the physical neighbors
+	uint32_t prev = nodes[index].prev_physical;
+	if (prev != null && nodes[prev].free) {
+		remove(prev);
+
+		uint32_t next = nodes[index].next_physical;
+
+		nodes[prev].size += nodes[index].size;
+		nodes[prev].next_physical = next;
+		if (next != null)
+			nodes[next].prev_physical = prev;
+
+		recycled.push_back(index);
+		index = prev;
+	}
+
+	uint32_t next = nodes[index].next_physical;
+	if (next != null && nodes[next].free) {
+		remove(next);
+
+		uint32_t after = nodes[next].next_physical;
+
+		nodes[index].size += nodes[next].size;
+		nodes[index].next_physical = after;
+		if (after != null)
+			nodes[after].prev_physical = index;
+
+		recycled.push_back(next);
+	}
+
+	insert(index);
+}
+
+// Allocator methods
+MemoryAllocator::MemoryAllocator(const vk::PhysicalDevice &phdev_,
+				 const vk::Device &device_,
+				 const vk::PhysicalDeviceMemoryProperties &properties_)
+		: phdev(phdev_), device(device_), properties(properties_)
+{
+	pools.resize(2 * properties.memoryTypeCount);
+
+	stats.types.resize(properties.memoryTypeCount);
+	stats.heaps.resize(properties.memoryHeapCount);
+
+	// Without the budget extension, leave some headroom for other processes
+	for (uint32_t i = 0; i < properties.memoryHeapCount; i++) {
+		stats.heaps[i].size = properties.memoryHeaps[i].size;
+		stats.heaps[i].budget = 4 * (properties.memoryHeaps[i].size / 5);
+	}
+}
+
+void MemoryAllocator::track_budget()
+{
+	std::lock_guard guard(lock);
+
+	budget_tracking = true;
+	refresh_budget();
+}
+
+void MemoryAllocator::refresh_budget()
+{
+	if (!budget_tracking)
+		return;
+
+	auto budget = vk::PhysicalDeviceMemoryBudgetPropertiesEXT();
+	auto memory_properties = vk::PhysicalDeviceMemoryProperties2();
+	memory_properties.pNext = &budget;
+
+	phdev.getMemoryProperties2(&memory_properties);
+
+	for (uint32_t i = 0; i < properties.memoryHeapCount; i++) {
+		stats.heaps[i].budget = budget.heapBudget[i];
+		stats.heaps[i].usage = budget.heapUsage[i];
+	}
+}
+
+vk::DeviceSize MemoryAllocator::preferred_block_size(uint32_t type) const
+{
+	static constexpr vk::DeviceSize large_block = 256ull << 20;
+	static constexpr vk::DeviceSize small_heap = 1ull << 30;
+
+	uint32_t heap = properties.memoryTypes[type].heapIndex;
+	vk::DeviceSize heap_size = properties.memoryHeaps[heap].size;
+
+	if (heap_size <= small_heap)
+		return align_up(heap_size / 8, granularity);
+
+	return large_block;
+}
+
+vk::DeviceMemory MemoryAllocator::reserve(vk::DeviceSize size, uint32_t type, bool respect_budget)
+{
+	uint32_t index = properties.memoryTypes[type].heapIndex;
+
+	auto &heap = stats.heaps[index];
+
+	if (respect_budget) {
+		refresh_budget();
+
+		if (heap.usage + size > heap.budget)
+			return nullptr;
+	}
+
+	auto memory_flags = vk::MemoryAllocateFlagsInfo()
+		.setFlags(vk::MemoryAllocateFlagBits::eDeviceAddress);
+
+	auto memory_info = vk::MemoryAllocateInfo()
+		.setAllocationSize(size)
+		.setMemoryTypeIndex(type)
+		.setPNext(&memory_flags);
+
+	vk::DeviceMemory memory;
+
+	try {
+		memory = device.allocateMemory(memory_info);
+	} catch (const vk::OutOfDeviceMemoryError &) {
+		howl_warning("heap #{} is out of memory ({} bytes requested)", index, size);
+		return nullptr;
+	}
+
+	stats.types[type].reserved += size;
+	stats.types[type].blocks++;
+
+	heap.reserved += size;
+	heap.blocks++;
+
+	if (!budget_tracking)
+		heap.usage += size;
+
+	return memory;
+}
+
+void MemoryAllocator::unreserve(Block &block, uint32_t type)
+{
+	auto &heap = stats.heaps[properties.memoryTypes[type].heapIndex];
+
+	stats.types[type].reserved -= block.size;
+	stats.types[type].blocks--;
+
+	heap.reserved -= block.size;
+	heap.blocks--;
+
+	if (!budget_tracking)
+		heap.usage -= block.size;
+
+	device.freeMemory(block.memory);
+}
+
+uint32_t MemoryAllocator::emplace_block(Pool &pool, std::unique_ptr <Block> &&block)
+{
+	if (pool.vacant.size()) {
+		uint32_t index = pool.vacant.back();
+		pool.vacant.pop_back();
+		pool.blocks[index] = std::move(block);
+		return index;
+	}
+
+	pool.blocks.emplace_back(std::move(block));
+	return pool.blocks.size() - 1;
+}
+
+static void account(MemoryUsage &usage, vk::DeviceSize size)
+{
+	usage.live += size;
+	usage.peak = std::max(usage.peak, usage.live);
+	usage.allocations++;
+}
+
+static void unaccount(MemoryUsage &usage, vk::DeviceSize size)
+{
+	usage.live -= size;
+	usage.allocations--;
+}
+
+Allocation MemoryAllocator::allocate(const vk::MemoryRequirements &requirements, uint32_t type, bool linear, bool respect_budget)
+{
+	std::lock_guard guard(lock);
+
+	auto result = Allocation();
+	result.type = type;
+	result.flags = properties.memoryTypes[type].propertyFlags;
+	result.pool = 2 * type + (linear ? 0 : 1);
+
+	auto &pool = pools[result.pool];
+
+	vk::DeviceSize size = align_up(requirements.size, granularity);
+	vk::DeviceSize block_size = preferred_block_size(type);
+
+	auto commit = [&](const Block &block, uint32_t node, uint32_t index) {
+		result.memory = block.memory;
+		result.offset = block.nodes[node].offset;
+		result.size = size;
+		result.node = node;
+		result.block = index;
+
+		account(stats.types[type], size);
+		account(stats.heaps[properties.memoryTypes[type].heapIndex], size);
+
+		return result;
+	};
+
+	if (size <= block_size / 2) {
+		for (uint32_t i = 0; i < pool.blocks.size(); i++) {
+			auto &block = pool.blocks[i];
+			if (!block || block->dedicated)
+				continue;
+
+			uint32_t node = block->allocate(size, requirements.alignment);
+			if (node != null)
+				return commit(*block, node, i);
+		}
+
+		// Nothing fits, so open a new block
+		if (auto memory = reserve(block_size, type, respect_budget)) {
+			howl_info("allocated {} MiB block for memory type #{}", block_size >> 20, type);
+
+			auto block = std::make_unique <Block> (memory, block_size, false);
+
+			uint32_t node = block->allocate(size, requirements.alignment);
+			howl_assert(node != null, "failed to sub-allocate from a fresh memory block");
+
+			auto &ref = *block;
+			return commit(ref, node, emplace_block(pool, std::move(block)));
+		}
+	}
+
+	// Large resources, or ones left without room for a new block, get their own memory
+	auto memory = reserve(size, type, respect_budget);
+	if (!memory)
+		return Allocation();
+
+	auto block = std::make_unique <Block> (memory, size, true);
+
+	auto &ref = *block;
+	return commit(ref, 0, emplace_block(pool, std::move(block)));
+}
+
+void MemoryAllocator::free(const Allocation &allocation)
+{
+	if (!allocation.valid())
+		return;
+
+	std::lock_guard guard(lock);
+
+	unaccount(stats.types[allocation.type], allocation.size);
+	unaccount(stats.heaps[properties.memoryTypes[allocation.type].heapIndex], allocation.size);
+
+	auto &pool = pools[allocation.pool];
+	auto &block = pool.blocks[allocation.block];
+
+	if (!block->dedicated) {
+		block->release(allocation.node);
+
+		if (block->used > 0)
+			return;
+
+		// Keep one empty block around per pool to avoid thrashing
+		size_t live = 0;
+		for (auto &b : pool.blocks)
+			live += (b && !b->dedicated);
+
+		if (live <= 1)
+			return;
+	}
+
+	unreserve(*block, allocation.type);
+	block.reset();
+	pool.vacant.push_back(allocation.block);
+}
+
+MemoryStats MemoryAllocator::statistics()
+{
+	std::lock_guard guard(lock);
+
+	refresh_budget();
+
+	return stats;
+}
+
+void *MemoryAllocator::map(const Allocation &allocation)
+{
+	std::lock_guard guard(lock);
+
+	auto &block = pools[allocation.pool].blocks[allocation.block];
+
+	// Blocks are mapped as a whole and shared by all their allocations
+	if (block->map_count++ == 0)
+		block->mapped = device.mapMemory(block->memory, 0, VK_WHOLE_SIZE);
+
+	return (int8_t *) block->mapped + allocation.offset;
+}
+
+void MemoryAllocator::unmap(const Allocation &allocation)
+{
+	std::lock_guard guard(lock);
+
+	auto &block = pools[allocation.pool].blocks[allocation.block];
+
+	howl_assert(block->map_count > 0, "unmapping an allocation which is not mapped");
+
+	if (--block->map_count == 0) {
+		device.unmapMemory(block->memory);
+		block->mapped = nullptr;
+	}
+}
+
+} // namespace oak
@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <numeric>
+
+#include <howler/howler.hpp>
+
+#include "attachments.hpp"
+
+namespace oak {
+
+uint32_t TransientAttachments::add(const ImageInfo &info, uint32_t first, uint32_t last)
+{
+	howl_assert(first <= last, "attachment lifetime [{}, {}] is empty", first, last);
+
+	entries.push_back({ info, first, last });
+	return entries.size() - 1;
+}
+
+void TransientAttachments::build(const Device &device)
+{
+	struct Slot {
+		vk::MemoryRequirements requirements;
+		std::vector <uint32_t> members;
+		bool lazy;
+	};
+
+	images.clear();
+	slots.clear();
+
+	std::vector <vk::MemoryRequirements> requirements;
+	for (auto &entry : entries) {
+		images.push_back(Image::unbound(device, entry.info));
+		requirements.push_back(device.getImageMemoryRequirements(images.back().handle));
+	}
+
+	// Place the largest attachments first
+	std::vector <uint32_t> order(entries.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(),
+		[&](uint32_t a, uint32_t b) {
+			return requirements[a].size > requirements[b].size;
+		});
+
+	auto overlaps = [&](uint32_t a, uint32_t b) {
+		return entries[a].first <= entries[b].last
+			&& entries[b].first <= entries[a].last;
+	};
+
+	std::vector <Slot> placement;
+	for (uint32_t i : order) {
+		auto &req = requirements[i];
+
+		bool placed = false;
+		for (auto &slot : placement) {
+			if (slot.lazy != entries[i].info.transient)
+				continue;
+
+			if (!(slot.requirements.memoryTypeBits & req.memoryTypeBits))
+				continue;
+
+			bool disjoint = std::none_of(slot.members.begin(), slot.members.end(),
+				[&](uint32_t j) { return overlaps(i, j); });
+
+			if (!disjoint)
+				continue;
+
+			slot.requirements.size = std::max(slot.requirements.size, req.size);
+			slot.requirements.alignment = std::max(slot.requirements.alignment, req.alignment);
+			slot.requirements.memoryTypeBits &= req.memoryTypeBits;
+			slot.members.push_back(i);
+
+			placed = true;
+			break;
+		}
+
+		if (!placed)
+			placement.push_back({ req, { i }, entries[i].info.transient });
+	}
+
+	// Allocate each slot once and bind all of its members to it
+	vk::DeviceSize total = 0;
+	vk::DeviceSize aliased = 0;
+
+	for (auto &slot : placement) {
+		vk::MemoryPropertyFlags preferred;
+		if (slot.lazy)
+			preferred = vk::MemoryPropertyFlagBits::eLazilyAllocated;
+
+		auto allocation = device.allocate(slot.requirements,
+			vk::MemoryPropertyFlagBits::eDeviceLocal,
+			preferred, false);
+
+		howl_assert(allocation.valid(), "failed to allocate {} bytes for {} transient attachments",
+			slot.requirements.size, slot.members.size());
+
+		for (uint32_t i : slot.members) {
+			images[i].bind(device, allocation, entries[i].info);
+			total += requirements[i].size;
+		}
+
+		aliased += slot.requirements.size;
+		slots.push_back(allocation);
+	}
+
+	howl_info("{} transient attachments placed in {} memory slots ({} KiB instead of {} KiB)",
+		entries.size(), slots.size(), aliased >> 10, total >> 10);
+}
+
+void TransientAttachments::destroy(const Device &device)
+{
+	// Memory is shared, so images are destroyed individually
+	for (auto &image : images) {
+		device.destroyImageView(image.view);
+		device.destroyImage(image.handle);
+	}
+
+	for (auto &allocation : slots)
+		device.release(allocation);
+
+	images.clear();
+	slots.clear();
+}
+
+void TransientAttachments::resize(const Device &device, const vk::Extent2D &extent)
+{
+	destroy(device);
+
+	for (auto &entry : entries)
+		entry.info.size = extent;
+
+	build(device);
+}
+
+} // namespace oak
@@ -0,0 +1,228 @@
+#include <cmath>
+
+#include <howler/howler.hpp>
+
+#include "culling.hpp"
+
+namespace oak {
+
+bool GpuCulling::supported(const Device &device)
+{
+	return device.icx_features.draw_indirect_count
+		&& device.icx_features.multi_draw_indirect;
+}
+
+void GpuCulling::dispatch(const vk::CommandBuffer &cmd, uint32_t frame, const float *view_projection) const
+{
+	auto &count = counts[frame];
+
+	// Every batch starts out empty
+	cmd.fillBuffer(count.handle, 0, count.size, 0);
+
+	auto cleared = vk::MemoryBarrier()
+		.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+		.setDstAccessMask(vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+
+	cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+		vk::PipelineStageFlagBits::eComputeShader,
+		{ }, cleared, { }, { });
+
+	Frustum constants = frustum(view_projection);
+	constants.draw_count = draw_count;
+
+	cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+	cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, layout, 0, descriptors[frame], {});
+	cmd.pushConstants <Frustum> (layout, vk::ShaderStageFlagBits::eCompute, 0, constants);
+	cmd.dispatch((draw_count + group_size - 1) / group_size, 1, 1);
+
+	// Compacted commands and counts are read by the draws
+	auto culled = vk::MemoryBarrier()
+		.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+		.setDstAccessMask(vk::AccessFlagBits::eIndirectCommandRead);
+
+	cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+		vk::PipelineStageFlagBits::eDrawIndirect,
+		{ }, culled, { }, { });
+}
+
+void GpuCulling::draw(const vk::CommandBuffer &cmd,
+		      uint32_t frame,
+		      const GeometryPool &pool,
+		      const DrawBatch &batch,
+		      uint32_t index) const
+{
+	constexpr vk::DeviceSize stride = sizeof(vk::DrawIndexedIndirectCommand);
+
+	cmd.bindIndexBuffer(pool.indices(batch.index_type).buffer.handle, 0, batch.index_type);
+	cmd.drawIndexedIndirectCountKHR(visible[frame].handle, batch.first * stride,
+		counts[frame].handle, index * sizeof(uint32_t),
+		batch.count, stride);
+}
+
+void GpuCulling::destroy(const Device &device) const
+{
+	bounds.destroy(device);
+
+	for (auto &buffer : visible)
+		buffer.destroy(device);
+
+	for (auto &buffer : counts)
+		buffer.destroy(device);
+
+	device.destroyDescriptorPool(descriptor_pool);
+	device.destroyPipeline(pipeline);
+	device.destroyPipelineLayout(layout);
+	device.destroyDescriptorSetLayout(dsl);
+}
+
+GpuCulling GpuCulling::from(const Device &device,
+			    StagingUploader &uploader,
+			    const vk::ShaderModule &module,
+			    const Buffer &commands,
+			    const std::vector <Bounds> &bounds,
+			    uint32_t batch_count,
+			    uint32_t frames)
+{
+	howl_assert(supported(device), "GPU culling requires multiDrawIndirect and VK_KHR_draw_indirect_count");
+	howl_assert(commands.size >= bounds.size() * sizeof(vk::DrawIndexedIndirectCommand),
+		"indirect buffer holds fewer commands than there are bounds");
+
+	GpuCulling result;
+	result.draw_count = bounds.size();
+	result.batch_count = batch_count;
+
+	// Commands, bounds, visible commands and counts
+	std::vector <vk::DescriptorSetLayoutBinding> bindings;
+	for (uint32_t i = 0; i < 4; i++) {
+		bindings.push_back(vk::DescriptorSetLayoutBinding()
+			.setBinding(i)
+			.setDescriptorType(vk::DescriptorType::eStorageBuffer)
+			.setStageFlags(vk::ShaderStageFlagBits::eCompute)
+			.setDescriptorCount(1));
+	}
+
+	result.dsl = device.createDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo().setBindings(bindings));
+
+	auto push_range = vk::PushConstantRange()
+		.setStageFlags(vk::ShaderStageFlagBits::eCompute)
+		.setOffset(0)
+		.setSize(sizeof(Frustum));
+
+	auto layout_info = vk::PipelineLayoutCreateInfo()
+		.setSetLayouts(result.dsl)
+		.setPushConstantRanges(push_range);
+
+	result.layout = device.createPipelineLayout(layout_info);
+
+	auto stage = vk::PipelineShaderStageCreateInfo()
+		.setStage(vk::ShaderStageFlagBits::eCompute)
+		.setModule(module)
+		.setPName("main");
+
+	auto pipeline_info = vk::ComputePipelineCreateInfo()
+		.setStage(stage)
+		.setLayout(result.layout);
+
+	result.pipeline = device.createComputePipeline(device.pipelineCache(), pipeline_info).value;
+
+	// Bounds are static, outputs are rewritten every frame
+	result.bounds = uploader.upload(bounds, vk::BufferUsageFlagBits::eStorageBuffer);
+
+	for (uint32_t i = 0; i < frames; i++) {
+		result.visible.push_back(Buffer::from(device,
+			std::max(commands.size, size_t(1)),
+			vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,
+			vk::MemoryPropertyFlagBits::eDeviceLocal));
+
+		result.counts.push_back(Buffer::from(device,
+			std::max(batch_count, 1u) * sizeof(uint32_t),
+			vk::BufferUsageFlagBits::eStorageBuffer
+				| vk::BufferUsageFlagBits::eIndirectBuffer
+				| vk::BufferUsageFlagBits::eTransferDst,
+			vk::MemoryPropertyFlagBits::eDeviceLocal));
+	}
+
+	auto pool_size = vk::DescriptorPoolSize()
+		.setType(vk::DescriptorType::eStorageBuffer)
+		.setDescriptorCount(4 * frames);
+
+	auto pool_info = vk::DescriptorPoolCreateInfo()
+		.setPoolSizes(pool_size)
+		.setMaxSets(frames);
+
+	result.descriptor_pool = device.createDescriptorPool(pool_info);
+
+	std::vector <vk::DescriptorSetLayout> layouts(frames, result.dsl);
+
+	auto alloc_info = vk::DescriptorSetAllocateInfo()
+		.setDescriptorPool(result.descriptor_pool)
+		.setSetLayouts(layouts);
+
+	result.descriptors = device.allocateDescriptorSets(alloc_info);
+
+	for (uint32_t i = 0; i < frames; i++) {
+		std::array <vk::DescriptorBufferInfo, 4> infos {
+			commands.descriptor(),
+			result.bounds.descriptor(),
+			result.visible[i].descriptor(),
+			result.counts[i].descriptor(),
+		};
+
+		std::array <vk::WriteDescriptorSet, 4> writes;
+		for (uint32_t j = 0; j < 4; j++) {
+			writes[j] = vk::WriteDescriptorSet()
+				.setBufferInfo(infos[j])
+				.setDstBinding(j)
+				.setDescriptorType(vk::DescriptorType::eStorageBuffer)
+				.setDstSet(result.descriptors[i]);
+		}
+
+		device.updateDescriptorSets(writes, {});
+	}
+
+	return result;
+}
+
+GpuCulling::Frustum GpuCulling::frustum(const float *m)
+{
+	auto row = [&](uint32_t r) {
+		return std::array <float, 4> { m[r], m[4 + r], m[8 + r], m[12 + r] };
+	};
+
+	auto normalize = [](std::array <float, 4> plane) {
+		float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+		if (length > 0.0f) {
+			for (float &v : plane)
+				v /= length;
+		}
+
+		return plane;
+	};
+
+	auto combine = [&](const std::array <float, 4> &a, const std::array <float, 4> &b, float sign) {
+		std::array <float, 4> plane;
+		for (uint32_t i = 0; i < 4; i++)
+			plane[i] = a[i] + sign * b[i];
+
+		return normalize(plane);
+	};
+
+	auto w = row(3);
+
+	Frustum result;
+	result.draw_count = 0;
+
+	// Left, right, bottom and top, from -w <= x, y <= w
+	for (uint32_t axis = 0; axis < 2; axis++) {
+		result.planes[2 * axis + 0] = combine(w, row(axis), 1.0f);
+		result.planes[2 * axis + 1] = combine(w, row(axis), -1.0f);
+	}
+
+	// Vulkan clip depth is 0 <= z <= w, so the near plane is z alone
+	result.planes[4] = normalize(row(2));
+	result.planes[5] = combine(w, row(2), -1.0f);
+
+	return result;
+}
+
+} // namespace oak
@@ -55,11 +55,17 @@ handle_collector(vk::DescriptorPool,	eDescriptorPool,	false);
 handle_collector(vk::CommandPool,	eCommandPool,		true);
 
 // Abstracted structures
+Deallocator &Deallocator::collect(const Allocation &allocation, const std::string &) &
+{
+	allocations.push_back(allocation);
+	return *this;
+}
+
 Deallocator &Deallocator::collect(const Image &image, const std::string &name) &
 {
 	collect(image.handle, name + ".handle");
 	collect(image.view,   name + ".view");
-	collect(image.memory, name + ".memory");
+	collect(image.memory);
 
 	return *this;
 }
@@ -67,15 +73,17 @@ Deallocator &Deallocator::collect(const Image &image, const std::string &name) &
 Deallocator &Deallocator::collect(const Buffer &buffer, const std::string &name) &
 {
 	collect(buffer.handle, name + ".handle");
-	collect(buffer.memory, name + ".memory");
+	collect(buffer.memory);
+
+	if (buffer.mapped)
+		mappings.push_back(buffer.memory);
 
 	return *this;
 }
 
 Deallocator &Deallocator::collect(const PrimarySynchronization &sync, const std::string &name) &
 {
-	for (auto &fence : sync.processing)
-		collect(fence);
+	collect(sync.timeline.semaphore);
 	for (auto &sem : sync.available)
 		collect(sem);
 	for (auto &sem : sync.finished)
@@ -97,8 +105,14 @@ Deallocator &Deallocator::collect(const Window &window, const std::string &name)
 Deallocator &Deallocator::collect(const DeviceResources &resources, const std::string &name) &
 {
 	collect(resources.command_pool, name + ".command pool");
+	collect(resources.compute_pool, name + ".compute pool");
+	collect(resources.transfer_pool, name + ".transfer pool");
 	collect(resources.descriptor_pool, name + ".decsriptor pool");
 
+	collect(resources.timeline.semaphore, name + ".timeline");
+	collect(resources.compute_timeline.semaphore, name + ".compute timeline");
+	collect(resources.transfer_timeline.semaphore, name + ".transfer timeline");
+
 	return *this;
 }
 
@@ -187,6 +201,15 @@ void Deallocator::drop()
 			break;
 		}
 	}
+
+	for (auto &allocation : mappings)
+		device.unmap(allocation);
+
+	for (auto &allocation : allocations)
+		device.release(allocation);
+
+	mappings.clear();
+	allocations.clear();
 }
 
 } // namespace oak
@@ -6,9 +6,19 @@ DeviceResources DeviceResources::from(const Device &device)
 {
 	DeviceResources result;
 
-	result.queue = device.getQueue(0, 0);
+	result.queue = device.getQueue(device.queues.graphics);
 	result.command_pool = device.createCommandPool(result.queue);
 
+	result.compute_queue = device.getQueue(device.queues.compute);
+	result.compute_pool = device.createCommandPool(result.compute_queue);
+
+	result.transfer_queue = device.getQueue(device.queues.transfer);
+	result.transfer_pool = device.createCommandPool(result.transfer_queue);
+
+	result.timeline = GpuTimeline::from(device, result.queue);
+	result.compute_timeline = GpuTimeline::from(device, result.compute_queue);
+	result.transfer_timeline = GpuTimeline::from(device, result.transfer_queue);
+
 	std::vector <vk::DescriptorPoolSize> pool_sizes {
 		vk::DescriptorPoolSize()
 			.setDescriptorCount(1)
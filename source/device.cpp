@@ -1,3 +1,8 @@
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <optional>
+
 #include <fmt/printf.h>
 
 #include <howler/howler.hpp>
@@ -13,11 +18,16 @@ Device::Device(const vk::PhysicalDevice &phdev, const vk::Device &lgdev)
 		: vk::PhysicalDevice(phdev), vk::Device(lgdev)
 {
 	memory_properties = getMemoryProperties();
+	allocator = std::make_shared <MemoryAllocator> (phdev, lgdev, memory_properties);
+	queue_locks = std::make_shared <QueueLocks> ();
+	pipeline_registry = std::make_shared <PipelineRegistry> (lgdev);
 
 	// Load necessary properties
 	auto phdev_properties = vk::PhysicalDeviceProperties2KHR();
 	phdev_properties.pNext = &properties.rtx_pipeline;
 	phdev.getProperties2(&phdev_properties);
+
+	properties.limits = phdev_properties.properties.limits;
 }
 
 Queue Device::getQueue(uint32_t family, uint32_t index) const
@@ -25,9 +35,27 @@ Queue Device::getQueue(uint32_t family, uint32_t index) const
 	Queue q = vk::Device::getQueue(family, index);
 	q.family = family;
 	q.index = index;
+	q.lock = queue_locks->get(q);
 	return q;
 }
 
+Queue Device::getQueue(const QueueSlot &slot) const
+{
+	return getQueue(slot.family, slot.index);
+}
+
+std::vector <uint32_t> Device::queueFamilies() const
+{
+	std::vector <uint32_t> families { queues.graphics.family };
+
+	for (auto family : { queues.compute.family, queues.transfer.family }) {
+		if (std::find(families.begin(), families.end(), family) == families.end())
+			families.push_back(family);
+	}
+
+	return families;
+}
+
 vk::CommandPool Device::createCommandPool(const Queue &queue) const
 {
 	auto command_pool_info = vk::CommandPoolCreateInfo()
@@ -37,6 +65,20 @@ vk::CommandPool Device::createCommandPool(const Queue &queue) const
 	return vk::Device::createCommandPool(command_pool_info);
 }
 
+vk::PipelineCache Device::pipelineCache() const
+{
+	return pipeline_cache ? pipeline_cache->handle : nullptr;
+}
+
+void Device::savePipelineCache() const
+{
+	// Optimized links still running would be missing from the cache
+	pipeline_registry->join();
+
+	if (pipeline_cache)
+		pipeline_cache->save();
+}
+
 void Device::waitAndReset(const vk::Fence &fence) const
 {
 	auto timeout = UINT64_MAX;
@@ -87,7 +129,7 @@ handle_namer(vk::CommandPool,		eCommandPool);
 
 void Device::name(const Buffer &buffer, const std::string &s) const
 {
-	name(buffer.memory, s + ".memory");
+	// Memory is shared between sub-allocations, so only the handle is named
 	name(buffer.handle, s + ".handle");
 }
 
@@ -131,15 +173,53 @@ std::vector <vk::CommandBuffer> Device::allocateCommandBuffers(const vk::Command
 	return allocateCommandBuffers(info);
 }
 
-uint32_t Device::findMemoryType(uint32_t filter, const vk::MemoryPropertyFlags &flags) const
+std::vector <uint32_t> Device::rankMemoryTypes(uint32_t filter, const vk::MemoryPropertyFlags &required, const vk::MemoryPropertyFlags &preferred) const
 {
+	// Only usable when explicitly asked for
+	vk::MemoryPropertyFlags exclusive = vk::MemoryPropertyFlagBits::eProtected
+		| vk::MemoryPropertyFlagBits::eLazilyAllocated
+		| vk::MemoryPropertyFlagBits::eDeviceCoherentAMD
+		| vk::MemoryPropertyFlagBits::eDeviceUncachedAMD;
+
+	auto requested = required | preferred;
+
+	std::vector <std::pair <int, uint32_t>> scored;
+
 	for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+		auto flags = memory_properties.memoryTypes[i].propertyFlags;
+
 		bool a = (filter & (1 << i)) == (1 << i);
-		bool b = (memory_properties.memoryTypes[i].propertyFlags & flags) == flags;
-		if (a && b)
-			return i;
+		bool b = (flags & required) == required;
+		bool c = !(flags & exclusive & ~requested);
+		if (!a || !b || !c)
+			continue;
+
+		// Reward preferred properties, penalize unrequested ones
+		// (e.g. keep staging memory out of the small ReBAR heap)
+		int hits = std::popcount(static_cast <VkMemoryPropertyFlags> (flags & preferred));
+		int extra = std::popcount(static_cast <VkMemoryPropertyFlags> (flags & ~requested));
+
+		scored.emplace_back(2 * hits - extra, i);
 	}
 
+	std::stable_sort(scored.begin(), scored.end(),
+		[](const auto &a, const auto &b) {
+			return a.first > b.first;
+		});
+
+	std::vector <uint32_t> result;
+	for (auto &[_, i] : scored)
+		result.push_back(i);
+
+	return result;
+}
+
+uint32_t Device::findMemoryType(uint32_t filter, const vk::MemoryPropertyFlags &flags, const vk::MemoryPropertyFlags &preferred) const
+{
+	auto ranked = rankMemoryTypes(filter, flags, preferred);
+	if (ranked.size())
+		return ranked.front();
+
 	howl_fatal("failed to find memory type");
 }
 
@@ -158,6 +238,49 @@ vk::DeviceMemory Device::allocateMemoryRequirements(const vk::MemoryRequirements
 	return vk::Device::allocateMemory(memory_info);
 }
 
+Allocation Device::allocate(const vk::MemoryRequirements &requirements,
+			    const vk::MemoryPropertyFlags &properties,
+			    const vk::MemoryPropertyFlags &preferred,
+			    bool linear) const
+{
+	auto candidates = rankMemoryTypes(requirements.memoryTypeBits, properties, preferred);
+	if (candidates.empty())
+		howl_fatal("failed to find memory type");
+
+	// Stay within the heap budgets first, then take what the driver gives
+	for (bool respect_budget : { true, false }) {
+		for (uint32_t type : candidates) {
+			auto allocation = allocator->allocate(requirements, type, linear, respect_budget);
+			if (allocation.valid())
+				return allocation;
+
+			howl_warning("memory type #{} cannot serve {} bytes, falling back", type, requirements.size);
+		}
+	}
+
+	howl_fatal("out of device memory ({} bytes requested)", requirements.size);
+}
+
+void Device::release(const Allocation &allocation) const
+{
+	allocator->free(allocation);
+}
+
+void *Device::map(const Allocation &allocation) const
+{
+	return allocator->map(allocation);
+}
+
+void Device::unmap(const Allocation &allocation) const
+{
+	allocator->unmap(allocation);
+}
+
+MemoryStats Device::memoryStats() const
+{
+	return allocator->statistics();
+}
+
 // TODO: pass extensions after assessing the platform
 struct VulkanFeatureBase {
 	VkStructureType sType;
@@ -216,6 +339,18 @@ struct VulkanFeatureChain : std::vector <VulkanFeatureBase *> {
 			feature_case(vk::PhysicalDeviceHostImageCopyFeaturesEXT)
 				.setHostImageCopy(true);
 				break;
+			feature_case(vk::PhysicalDeviceTimelineSemaphoreFeatures)
+				.setTimelineSemaphore(true);
+				break;
+			feature_case(vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT)
+				.setGraphicsPipelineLibrary(true);
+				break;
+			feature_case(vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT)
+				.setExtendedDynamicState(true);
+				break;
+			case (VkStructureType) vk::PhysicalDeviceExtendedDynamicState3FeaturesEXT::structureType:
+				// Individual states, left enabled as far as supported
+				break;
 			default:
 				howl_error("unchecked feature #{}", (int) ptr->sType);
 				break;
@@ -223,12 +358,16 @@ struct VulkanFeatureChain : std::vector <VulkanFeatureBase *> {
 		}
 	}
 
-	static auto basline(bool renderdoc) -> VulkanFeatureChain {
+	static auto basline(bool renderdoc,
+			    bool host_image_copy,
+			    bool graphics_pipeline_library,
+			    bool extended_dynamic_state,
+			    bool extended_dynamic_state3) -> VulkanFeatureChain {
 		VulkanFeatureChain features;
 
 		features.add <vk::PhysicalDeviceBufferDeviceAddressFeaturesKHR> ();
-		features.add <vk::PhysicalDeviceHostImageCopyFeaturesEXT> ();
 		features.add <vk::PhysicalDeviceDescriptorIndexingFeatures> ();
+		features.add <vk::PhysicalDeviceTimelineSemaphoreFeatures> ();
 
 		if (!renderdoc) {
 			features.add <vk::PhysicalDeviceScalarBlockLayoutFeaturesEXT> ();
@@ -236,15 +375,106 @@ struct VulkanFeatureChain : std::vector <VulkanFeatureBase *> {
 			features.add <vk::PhysicalDeviceAccelerationStructureFeaturesKHR> ();
 		}
 
+		if (host_image_copy)
+			features.add <vk::PhysicalDeviceHostImageCopyFeaturesEXT> ();
+
+		if (graphics_pipeline_library)
+			features.add <vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT> ();
+
+		if (extended_dynamic_state)
+			features.add <vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT> ();
+
+		if (extended_dynamic_state3)
+			features.add <vk::PhysicalDeviceExtendedDynamicState3FeaturesEXT> ();
+
 		return features;
 	}
 };
 
+// First family with all the required and none of the excluded capabilities
+static std::optional <uint32_t> find_queue_family(const std::vector <vk::QueueFamilyProperties> &families,
+						  const vk::QueueFlags &required,
+						  const vk::QueueFlags &excluded = {})
+{
+	for (uint32_t i = 0; i < families.size(); i++) {
+		auto flags = families[i].queueFlags;
+		if (families[i].queueCount == 0)
+			continue;
+
+		if ((flags & required) == required && !(flags & excluded))
+			return i;
+	}
+
+	return std::nullopt;
+}
+
 Device Device::create(bool renderdoc)
 {
 	// Construct the physical device handle
 	auto phdev = vk_globals.instance.enumeratePhysicalDevices().front();
 
+	// Optional extensions
+	auto available_extensions = phdev.enumerateDeviceExtensionProperties();
+
+	auto supported = [&](const char *name) {
+		for (auto &ext : available_extensions) {
+			if (std::strcmp(ext.extensionName, name) == 0)
+				return true;
+		}
+
+		return false;
+	};
+
+	// Host image copies are used only if the feature itself is present
+	bool host_image_copy = supported(VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME);
+	if (host_image_copy) {
+		auto ft_host_image = vk::PhysicalDeviceHostImageCopyFeaturesEXT();
+		auto ft_query = vk::PhysicalDeviceFeatures2KHR().setPNext(&ft_host_image);
+		phdev.getFeatures2(&ft_query);
+
+		host_image_copy = ft_host_image.hostImageCopy;
+	}
+
+	// Pipeline libraries are only worth it when linking them is fast
+	bool graphics_pipeline_library = supported(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME)
+		&& supported(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+
+	if (graphics_pipeline_library) {
+		auto ft_library = vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT();
+		auto ft_query = vk::PhysicalDeviceFeatures2KHR().setPNext(&ft_library);
+		phdev.getFeatures2(&ft_query);
+
+		auto pr_library = vk::PhysicalDeviceGraphicsPipelineLibraryPropertiesEXT();
+		auto pr_query = vk::PhysicalDeviceProperties2KHR().setPNext(&pr_library);
+		phdev.getProperties2(&pr_query);
+
+		graphics_pipeline_library = ft_library.graphicsPipelineLibrary
+			&& pr_library.graphicsPipelineLibraryFastLinking;
+	}
+
+	// Raster state that pipelines may leave to be set while recording;
+	// of the third extension only polygon modes and blend enables are used
+	bool extended_dynamic_state = supported(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+	bool extended_dynamic_state3 = supported(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME);
+
+	auto ft_dynamic = vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT();
+	auto ft_dynamic3 = vk::PhysicalDeviceExtendedDynamicState3FeaturesEXT();
+
+	if (extended_dynamic_state) {
+		auto ft_query = vk::PhysicalDeviceFeatures2KHR().setPNext(&ft_dynamic);
+		phdev.getFeatures2(&ft_query);
+
+		extended_dynamic_state = ft_dynamic.extendedDynamicState;
+	}
+
+	if (extended_dynamic_state3) {
+		auto ft_query = vk::PhysicalDeviceFeatures2KHR().setPNext(&ft_dynamic3);
+		phdev.getFeatures2(&ft_query);
+
+		extended_dynamic_state3 = ft_dynamic3.extendedDynamicState3PolygonMode
+			|| ft_dynamic3.extendedDynamicState3ColorBlendEnable;
+	}
+
 	// Query properties
 	auto properties = vk::PhysicalDeviceProperties2KHR();
 	auto pr_raytracing = vk::PhysicalDeviceRayTracingPipelinePropertiesKHR();
@@ -253,10 +483,22 @@ Device Device::create(bool renderdoc)
 
 	properties.pNext = &pr_raytracing;
 	pr_raytracing.pNext = &pr_acceleration;
-	pr_acceleration.pNext = &pr_host_image;
+
+	if (host_image_copy)
+		pr_acceleration.pNext = &pr_host_image;
 
 	phdev.getProperties2(&properties);
 
+	// Second query for the layouts usable by host image copies
+	std::vector <vk::ImageLayout> copy_src_layouts(pr_host_image.copySrcLayoutCount);
+	std::vector <vk::ImageLayout> copy_dst_layouts(pr_host_image.copyDstLayoutCount);
+
+	if (host_image_copy) {
+		pr_host_image.setCopySrcLayouts(copy_src_layouts);
+		pr_host_image.setCopyDstLayouts(copy_dst_layouts);
+		phdev.getProperties2(&properties);
+	}
+
 	howl_info("raytracing properties:");
 	fmt::println("\tbase size: {}", pr_raytracing.shaderGroupBaseAlignment);
 	fmt::println("\thandle size: {}", pr_raytracing.shaderGroupHandleSize);
@@ -267,16 +509,45 @@ Device Device::create(bool renderdoc)
 	fmt::println("\tmax geometry: {}", pr_acceleration.maxGeometryCount);
 	fmt::println("\tmax instances: {}", pr_acceleration.maxInstanceCount);
 
-	howl_info("host image copy properties:");
-	fmt::println("\tidentical memory type requirements: {}", pr_host_image.identicalMemoryTypeRequirements);
+	if (host_image_copy) {
+		howl_info("host image copy properties:");
+		fmt::println("\tidentical memory type requirements: {}", pr_host_image.identicalMemoryTypeRequirements);
+		fmt::println("\tcopy layouts: {} source, {} destination", copy_src_layouts.size(), copy_dst_layouts.size());
+	} else {
+		howl_warning("host image copy is unsupported, image transfers will be staged");
+	}
 
 	// Extensions for the devices
 	std::vector <const char *> device_extension_names {
 		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
 		VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
-		VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME,
 	};
 
+	if (host_image_copy)
+		device_extension_names.push_back(VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME);
+
+	bool memory_budget = supported(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+	if (memory_budget)
+		device_extension_names.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+	if (graphics_pipeline_library) {
+		device_extension_names.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+		device_extension_names.push_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+	} else {
+		howl_warning("graphics pipeline libraries are unsupported, pipelines will be compiled whole");
+	}
+
+	if (extended_dynamic_state)
+		device_extension_names.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+
+	if (extended_dynamic_state3)
+		device_extension_names.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME);
+
+	// Draw counts read from device memory, for GPU driven culling
+	bool draw_indirect_count = supported(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	if (draw_indirect_count)
+		device_extension_names.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+
 	// Logical device features
 	// TODO: pass features...
 	if (!renderdoc) {
@@ -287,20 +558,65 @@ Device Device::create(bool renderdoc)
 		});
 	}
 	
-	auto features = VulkanFeatureChain::basline(renderdoc);
+	auto features = VulkanFeatureChain::basline(renderdoc,
+		host_image_copy,
+		graphics_pipeline_library,
+		extended_dynamic_state,
+		extended_dynamic_state3);
 	features.activate(phdev);
 
+	// Discover queue families: a graphics family (assumed to present),
+	// preferably a compute family without graphics for async compute,
+	// and preferably a transfer only family for the copy engines
+	using Q = vk::QueueFlagBits;
+
+	auto queue_families = phdev.getQueueFamilyProperties();
+
+	auto graphics = find_queue_family(queue_families, Q::eGraphics | Q::eCompute);
+	howl_assert(graphics, "device has no graphics and compute queue family");
+
+	auto compute = find_queue_family(queue_families, Q::eCompute, Q::eGraphics);
+	auto transfer = find_queue_family(queue_families, Q::eTransfer, Q::eGraphics | Q::eCompute);
+
+	// Roles sharing a family get separate queues while the family has them
+	std::vector <uint32_t> queue_counts(queue_families.size(), 0);
+
+	auto assign = [&](uint32_t family) {
+		uint32_t index = std::min(queue_counts[family], queue_families[family].queueCount - 1);
+		queue_counts[family]++;
+		return QueueSlot { family, index };
+	};
+
+	Queues queues;
+	queues.graphics = assign(*graphics);
+	queues.compute = assign(compute.value_or(*graphics));
+	queues.transfer = assign(transfer.value_or(compute.value_or(*graphics)));
+
+	howl_info("queue families: graphics #{}.{}, compute #{}.{}, transfer #{}.{}",
+		queues.graphics.family, queues.graphics.index,
+		queues.compute.family, queues.compute.index,
+		queues.transfer.family, queues.transfer.index);
+
 	// Construct the logical device handle
-	auto priority = 1.0f;
+	std::vector <float> priorities(3, 1.0f);
+
+	std::vector <vk::DeviceQueueCreateInfo> lgdev_queue_infos;
+	for (uint32_t i = 0; i < queue_families.size(); i++) {
+		if (queue_counts[i] == 0)
+			continue;
 
-	// TODO: configure the number of queues and pass to the Device structure
-	auto lgdev_queue_info = vk::DeviceQueueCreateInfo()
-		.setQueueFamilyIndex(0)
-		.setQueuePriorities(priority)
-		.setQueueCount(1);
+		uint32_t count = std::min(queue_counts[i], queue_families[i].queueCount);
+
+		auto lgdev_queue_info = vk::DeviceQueueCreateInfo()
+			.setQueueFamilyIndex(i)
+			.setPQueuePriorities(priorities.data())
+			.setQueueCount(count);
+
+		lgdev_queue_infos.push_back(lgdev_queue_info);
+	}
 
 	auto lgdev_info = vk::DeviceCreateInfo()
-		.setQueueCreateInfos(lgdev_queue_info)
+		.setQueueCreateInfos(lgdev_queue_infos)
 		.setPEnabledExtensionNames(device_extension_names)
 		.setPEnabledFeatures(nullptr)
 		.setPNext(&features.top);
@@ -308,10 +624,36 @@ Device Device::create(bool renderdoc)
 	auto lgdev = phdev.createDevice(lgdev_info);
 
 	auto result = Device(phdev, lgdev);
+	result.queues = queues;
 
 	if (!renderdoc)
 		result.icx_features.raytracing = true;
 
+	if (host_image_copy) {
+		result.icx_features.host_image_copy = true;
+		result.properties.copy_src_layouts = copy_src_layouts;
+		result.properties.copy_dst_layouts = copy_dst_layouts;
+	}
+
+	// Core features are enabled whenever the device supports them
+	result.icx_features.multi_draw_indirect = features.top.features.multiDrawIndirect;
+	result.icx_features.draw_indirect_count = draw_indirect_count;
+	result.icx_features.graphics_pipeline_library = graphics_pipeline_library;
+
+	result.icx_features.dynamic_state = extended_dynamic_state;
+	result.icx_features.dynamic_polygon_mode = extended_dynamic_state3
+		&& ft_dynamic3.extendedDynamicState3PolygonMode;
+	result.icx_features.dynamic_blend_enable = extended_dynamic_state3
+		&& ft_dynamic3.extendedDynamicState3ColorBlendEnable;
+
+	if (memory_budget) {
+		result.icx_features.memory_budget = true;
+		result.allocator->track_budget();
+	}
+
+	auto cache = PipelineCache::load(phdev, lgdev, PipelineCache::default_path());
+	result.pipeline_cache = std::make_shared <PipelineCache> (cache);
+
 	return result;
 }
 
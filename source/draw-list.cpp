@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <array>
+#include <numeric>
+
+#include "draw-list.hpp"
+
+namespace oak {
+
+template <typename K>
+static uint64_t identify(std::unordered_map <K, uint64_t> &ids, const K &handle, uint32_t bits)
+{
+	auto [it, inserted] = ids.try_emplace(handle, ids.size());
+	return std::min(it->second, (uint64_t(1) << bits) - 1);
+}
+
+DrawList::Draw &DrawList::emplace(const DrawState &state, float depth, const void *push, uint32_t size)
+{
+	uint64_t pipeline = identify(pipeline_ids, (VkPipeline) state.pipeline, pipeline_bits);
+	uint64_t descriptors = identify(descriptor_ids, (VkDescriptorSet) state.descriptors, descriptor_bits);
+	uint64_t vertex_buffer = identify(vertex_buffer_ids, (VkBuffer) state.vertex_buffer, vertex_buffer_bits);
+
+	// Non-negative floats order the same as their bit patterns
+	uint32_t bits;
+	depth = std::max(depth, 0.0f);
+	std::memcpy(&bits, &depth, sizeof(bits));
+
+	uint64_t key = (pipeline << (descriptor_bits + vertex_buffer_bits + depth_bits))
+		| (descriptors << (vertex_buffer_bits + depth_bits))
+		| (vertex_buffer << depth_bits)
+		| (bits >> (32 - depth_bits));
+
+	keys.push_back(key);
+
+	Draw draw;
+	draw.state = state;
+	draw.constants_offset = constants.size();
+	draw.constants_size = size;
+
+	constants.insert(constants.end(), (const uint8_t *) push, (const uint8_t *) push + size);
+
+	return draws.emplace_back(draw);
+}
+
+void DrawList::record(const vk::CommandBuffer &cmd)
+{
+	sorted_keys = keys;
+	order.resize(draws.size());
+	std::iota(order.begin(), order.end(), 0);
+
+	radix_sort(sorted_keys, order, scratch_keys, scratch_order);
+
+	stats = {};
+
+	DrawState bound;
+
+	// Push constants last pushed, valid until the layout changes
+	const Draw *pushed = nullptr;
+
+	auto track = [](DrawStats::Counter &counter, bool same) {
+		if (same)
+			counter.skipped++;
+		else
+			counter.issued++;
+
+		return !same;
+	};
+
+	for (uint32_t i : order) {
+		const Draw &draw = draws[i];
+		const DrawState &state = draw.state;
+
+		if (track(stats.pipelines, state.pipeline == bound.pipeline)) {
+			cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, state.pipeline);
+			bound.pipeline = state.pipeline;
+		}
+
+		// Sets and constants are only kept across identical layouts
+		if (state.layout != bound.layout) {
+			bound.layout = state.layout;
+			bound.descriptors = nullptr;
+			pushed = nullptr;
+		}
+
+		if (state.descriptors) {
+			if (track(stats.descriptors, state.descriptors == bound.descriptors)) {
+				cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, state.layout, 0, state.descriptors, {});
+				bound.descriptors = state.descriptors;
+			}
+		}
+
+		if (state.vertex_buffer) {
+			if (track(stats.vertex_buffers, state.vertex_buffer == bound.vertex_buffer)) {
+				cmd.bindVertexBuffers(0, state.vertex_buffer, { 0 });
+				bound.vertex_buffer = state.vertex_buffer;
+			}
+		}
+
+		if (state.index_buffer) {
+			bool same = (state.index_buffer == bound.index_buffer)
+				&& (state.index_type == bound.index_type);
+
+			if (track(stats.index_buffers, same)) {
+				cmd.bindIndexBuffer(state.index_buffer, 0, state.index_type);
+				bound.index_buffer = state.index_buffer;
+				bound.index_type = state.index_type;
+			}
+		}
+
+		if (draw.constants_size > 0) {
+			bool same = pushed
+				&& pushed->state.push_stages == state.push_stages
+				&& pushed->constants_size == draw.constants_size
+				&& !std::memcmp(constants.data() + pushed->constants_offset,
+					constants.data() + draw.constants_offset,
+					draw.constants_size);
+
+			if (track(stats.push_constants, same)) {
+				cmd.pushConstants(state.layout, state.push_stages, 0,
+					draw.constants_size, constants.data() + draw.constants_offset);
+
+				pushed = &draw;
+			}
+		}
+
+		if (draw.count_buffer) {
+			cmd.drawIndexedIndirectCountKHR(draw.indirect, draw.offset,
+				draw.count_buffer, draw.count_offset,
+				draw.count, sizeof(vk::DrawIndexedIndirectCommand));
+
+			stats.draws++;
+		} else if (draw.indirect) {
+			constexpr vk::DeviceSize stride = sizeof(vk::DrawIndexedIndirectCommand);
+
+			for (uint32_t j = 0; j < draw.count; j += max_draws) {
+				uint32_t count = std::min(max_draws, draw.count - j);
+				cmd.drawIndexedIndirect(draw.indirect, draw.offset + j * stride, count, stride);
+				stats.draws++;
+			}
+		} else {
+			auto &command = draw.command;
+			cmd.drawIndexed(command.indexCount, command.instanceCount,
+				command.firstIndex, command.vertexOffset, command.firstInstance);
+			stats.draws++;
+		}
+	}
+
+	clear();
+}
+
+void DrawList::clear()
+{
+	draws.clear();
+	keys.clear();
+	constants.clear();
+
+	pipeline_ids.clear();
+	descriptor_ids.clear();
+	vertex_buffer_ids.clear();
+}
+
+void DrawList::radix_sort(std::vector <uint64_t> &keys,
+			  std::vector <uint32_t> &indices,
+			  std::vector <uint64_t> &scratch_keys,
+			  std::vector <uint32_t> &scratch_indices)
+{
+	size_t count = keys.size();
+
+	scratch_keys.resize(count);
+	scratch_indices.resize(count);
+
+	// Eight passes of one byte each, stable from the lowest byte up
+	for (uint32_t shift = 0; shift < 64; shift += 8) {
+		std::array <uint32_t, 256> histogram {};
+		for (uint64_t key : keys)
+			histogram[(key >> shift) & 0xFF]++;
+
+		// Every key shares this byte, so the pass would not move anything
+		if (histogram[(keys.empty() ? 0 : (keys[0] >> shift) & 0xFF)] == count)
+			continue;
+
+		uint32_t sum = 0;
+		for (auto &bucket : histogram) {
+			uint32_t size = bucket;
+			bucket = sum;
+			sum += size;
+		}
+
+		for (size_t i = 0; i < count; i++) {
+			uint32_t slot = histogram[(keys[i] >> shift) & 0xFF]++;
+			scratch_keys[slot] = keys[i];
+			scratch_indices[slot] = indices[i];
+		}
+
+		std::swap(keys, scratch_keys);
+		std::swap(indices, scratch_indices);
+	}
+}
+
+} // namespace oak
@@ -0,0 +1,234 @@
+#include <algorithm>
+#include <numeric>
+
+#include <howler/howler.hpp>
+
+#include "geometry-pool.hpp"
+
+namespace oak {
+
+// Arenas
+std::optional <uint32_t> GeometryPool::Arena::allocate(uint32_t count)
+{
+	for (auto it = free.begin(); it != free.end(); it++) {
+		if (it->count < count)
+			continue;
+
+		uint32_t offset = it->offset;
+
+		it->offset += count;
+		it->count -= count;
+
+		if (it->count == 0)
+			free.erase(it);
+
+		return offset;
+	}
+
+	return std::nullopt;
+}
+
+void GeometryPool::Arena::release(uint32_t offset, uint32_t count)
+{
+	if (count == 0)
+		return;
+
+	auto it = std::lower_bound(free.begin(), free.end(), offset,
+		[](const Range &range, uint32_t offset) {
+			return range.offset < offset;
+		});
+
+	it = free.insert(it, Range { offset, count });
+
+	// Merge with the following range, then with the preceding one
+	auto next = it + 1;
+	if (next != free.end() && it->offset + it->count == next->offset) {
+		it->count += next->count;
+		free.erase(next);
+	}
+
+	if (it != free.begin()) {
+		auto prev = it - 1;
+		if (prev->offset + prev->count == it->offset) {
+			prev->count += it->count;
+			free.erase(it);
+		}
+	}
+}
+
+// Geometry pool
+GeometryPool::Arena &GeometryPool::indices(vk::IndexType type)
+{
+	return (type == vk::IndexType::eUint16) ? indices16 : indices32;
+}
+
+const GeometryPool::Arena &GeometryPool::indices(vk::IndexType type) const
+{
+	return (type == vk::IndexType::eUint16) ? indices16 : indices32;
+}
+
+std::optional <GeometryPool::Geometry> GeometryPool::allocate(uint32_t vertex_count, uint32_t index_count, vk::IndexType type)
+{
+	howl_assert(type == vk::IndexType::eUint16 || type == vk::IndexType::eUint32,
+		"geometry pool only holds 16 and 32-bit indices");
+
+	auto first_vertex = vertices.allocate(vertex_count);
+	if (!first_vertex)
+		return std::nullopt;
+
+	auto first_index = indices(type).allocate(index_count);
+	if (!first_index) {
+		vertices.release(*first_vertex, vertex_count);
+		return std::nullopt;
+	}
+
+	Geometry result;
+	result.first_vertex = *first_vertex;
+	result.vertex_count = vertex_count;
+	result.first_index = *first_index;
+	result.index_count = index_count;
+	result.index_type = type;
+
+	return result;
+}
+
+void GeometryPool::free(const Geometry &geometry)
+{
+	vertices.release(geometry.first_vertex, geometry.vertex_count);
+	indices(geometry.index_type).release(geometry.first_index, geometry.index_count);
+}
+
+std::optional <GeometryPool::Geometry> GeometryPool::add(StagingUploader &uploader,
+							   const void *vertex_data,
+							   uint32_t vertex_count,
+							   const void *index_data,
+							   uint32_t index_count,
+							   vk::IndexType type)
+{
+	auto geometry = allocate(vertex_count, index_count, type);
+	if (!geometry) {
+		howl_warning("geometry pool cannot fit {} vertices and {} indices", vertex_count, index_count);
+		return std::nullopt;
+	}
+
+	auto &index_arena = indices(type);
+
+	uploader.upload(vertices.buffer, vertex_data,
+		size_t(vertex_count) * vertices.stride,
+		size_t(geometry->first_vertex) * vertices.stride);
+
+	uploader.upload(index_arena.buffer, index_data,
+		size_t(index_count) * index_arena.stride,
+		size_t(geometry->first_index) * index_arena.stride);
+
+	return geometry;
+}
+
+void GeometryPool::bind(const vk::CommandBuffer &cmd) const
+{
+	cmd.bindVertexBuffers(0, vertices.buffer.handle, { 0 });
+}
+
+void GeometryPool::destroy(const Device &device) const
+{
+	for (const Arena *arena : { &vertices, &indices16, &indices32 }) {
+		if (arena->buffer.valid())
+			arena->buffer.destroy(device);
+	}
+}
+
+GeometryPool GeometryPool::from(const Device &device,
+				uint32_t stride,
+				uint32_t vertex_capacity,
+				uint32_t index16_capacity,
+				uint32_t index32_capacity)
+{
+	GeometryPool result;
+
+	auto arena = [&](Arena &arena, uint32_t element, uint32_t capacity, const vk::BufferUsageFlags &usage) {
+		arena.stride = element;
+		if (capacity == 0)
+			return;
+
+		arena.buffer = Buffer::from(device,
+			size_t(capacity) * element,
+			usage | vk::BufferUsageFlagBits::eTransferDst,
+			vk::MemoryPropertyFlagBits::eDeviceLocal,
+			{ }, true);
+
+		arena.free.push_back(Range { 0, capacity });
+	};
+
+	arena(result.vertices, stride, vertex_capacity, vk::BufferUsageFlagBits::eVertexBuffer);
+	arena(result.indices16, sizeof(uint16_t), index16_capacity, vk::BufferUsageFlagBits::eIndexBuffer);
+	arena(result.indices32, sizeof(uint32_t), index32_capacity, vk::BufferUsageFlagBits::eIndexBuffer);
+
+	if (device.icx_features.multi_draw_indirect)
+		result.max_draws = device.properties.limits.maxDrawIndirectCount;
+
+	return result;
+}
+
+// Indirect draw builder
+void IndirectDrawBuilder::add(uint64_t key, const GeometryPool::Geometry &geometry, uint32_t instance_count, uint32_t first_instance)
+{
+	auto command = vk::DrawIndexedIndirectCommand()
+		.setIndexCount(geometry.index_count)
+		.setInstanceCount(instance_count)
+		.setFirstIndex(geometry.first_index)
+		.setVertexOffset(geometry.first_vertex)
+		.setFirstInstance(first_instance);
+
+	draws.push_back(Draw { key, geometry.index_type, command });
+}
+
+void IndirectDrawBuilder::build(std::vector <vk::DrawIndexedIndirectCommand> &commands,
+				std::vector <DrawBatch> &batches,
+				std::vector <uint32_t> *sources) const
+{
+	std::vector <uint32_t> order(draws.size());
+	std::iota(order.begin(), order.end(), 0);
+
+	std::stable_sort(order.begin(), order.end(),
+		[&](uint32_t a, uint32_t b) {
+			if (draws[a].key != draws[b].key)
+				return draws[a].key < draws[b].key;
+
+			return draws[a].index_type < draws[b].index_type;
+		});
+
+	commands.clear();
+	batches.clear();
+
+	for (uint32_t i : order) {
+		auto &draw = draws[i];
+
+		bool same = !batches.empty()
+			&& batches.back().key == draw.key
+			&& batches.back().index_type == draw.index_type;
+
+		if (!same)
+			batches.push_back(DrawBatch { draw.key, draw.index_type, uint32_t(commands.size()), 0 });
+
+		commands.push_back(draw.command);
+		batches.back().count++;
+	}
+
+	if (sources)
+		*sources = std::move(order);
+}
+
+void IndirectDrawBuilder::draw(const vk::CommandBuffer &cmd, const GeometryPool &pool, const Buffer &indirect, const DrawBatch &batch)
+{
+	cmd.bindIndexBuffer(pool.indices(batch.index_type).buffer.handle, 0, batch.index_type);
+
+	constexpr vk::DeviceSize stride = sizeof(vk::DrawIndexedIndirectCommand);
+
+	// Batches beyond the device's draw count limit take several calls
+	for (uint32_t i = 0; i < batch.count; i += pool.max_draws) {
+		uint32_t count = std::min(pool.max_draws, batch.count - i);
+		cmd.drawIndexedIndirect(indirect.handle, (batch.first + i) * stride, count, stride);
+	}
+}
+
+} // namespace oak
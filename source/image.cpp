@@ -1,20 +1,75 @@
+#include <algorithm>
+
+#include <vulkan/vulkan_format_traits.hpp>
+
+#include <howler/howler.hpp>
+
 #include "buffer.hpp"
 #include "image.hpp"
+#include "staging.hpp"
 #include "util.hpp"
 
 namespace oak {
 
 void Image::destroy(const Device &device)
 {
+	device.destroyImageView(view);
 	device.destroyImage(handle);
-	device.freeMemory(memory);
+	device.release(memory);
+}
+
+size_t Image::bytes() const
+{
+	return bytes(format, size);
+}
+
+size_t Image::bytes(const vk::Format &format, const vk::Extent2D &size)
+{
+	// Accounts for block compressed formats
+	auto extent = vk::blockExtent(format);
+
+	size_t columns = (size.width + extent[0] - 1) / extent[0];
+	size_t rows = (size.height + extent[1] - 1) / extent[1];
+
+	return columns * rows * vk::blockSize(format);
+}
+
+size_t Image::footprint() const
+{
+	return bytes(format, size, 0, mip_levels);
+}
+
+size_t Image::bytes(const vk::Format &format, const vk::Extent2D &size, uint32_t first, uint32_t count)
+{
+	size_t result = 0;
+	for (uint32_t level = first; level < first + count; level++) {
+		auto extent = vk::Extent2D(
+			std::max(size.width >> level, 1u),
+			std::max(size.height >> level, 1u));
+
+		result += bytes(format, extent);
+	}
+
+	return result;
 }
 
 void Image::download(const vk::CommandBuffer &cmd,
 		     const Buffer &destination,
 		     const vk::ImageLayout &incoming,
 		     const vk::PipelineStageFlags &begin,
-		     const vk::PipelineStageFlags &end)
+		     const vk::PipelineStageFlags &end,
+		     const vk::AccessFlags &written) const
+{
+	download(cmd, destination, 0, incoming, begin, end, written);
+}
+
+void Image::download(const vk::CommandBuffer &cmd,
+		     const Buffer &destination,
+		     size_t offset,
+		     const vk::ImageLayout &incoming,
+		     const vk::PipelineStageFlags &begin,
+		     const vk::PipelineStageFlags &end,
+		     const vk::AccessFlags &written) const
 {
 	vk::ImageAspectFlagBits aspect = vk::ImageAspectFlagBits::eColor;
 
@@ -24,7 +79,7 @@ void Image::download(const vk::CommandBuffer &cmd,
 	transition(cmd, handle, aspect,
 		incoming,
 		vk::ImageLayout::eTransferSrcOptimal,
-		vk::AccessFlagBits::eNone,
+		written,
 		vk::AccessFlagBits::eTransferRead,
 		begin,
 		vk::PipelineStageFlagBits::eTransfer);
@@ -37,7 +92,7 @@ void Image::download(const vk::CommandBuffer &cmd,
 
 	auto region = vk::BufferImageCopy()
 		.setImageOffset(vk::Offset3D(0, 0, 0))
-		.setBufferOffset(0)
+		.setBufferOffset(offset)
 		.setImageSubresource(subresource)
 		.setImageExtent(vk::Extent3D(size, 1));
 
@@ -55,11 +110,295 @@ void Image::download(const vk::CommandBuffer &cmd,
 		end);
 }
 
-Image Image::from(const Device &device, const ImageInfo &config)
+// Host transfer usage is only worth adding if it keeps optimal device access
+static bool supports_host_transfer(const Device &device, const vk::Format &format, const vk::ImageUsageFlags &usage)
+{
+	auto format_info = vk::PhysicalDeviceImageFormatInfo2()
+		.setFormat(format)
+		.setType(vk::ImageType::e2D)
+		.setTiling(vk::ImageTiling::eOptimal)
+		.setUsage(usage | vk::ImageUsageFlagBits::eHostTransferEXT);
+
+	try {
+		auto query = device.vk::PhysicalDevice::getImageFormatProperties2 <vk::ImageFormatProperties2,
+			vk::HostImageCopyDevicePerformanceQueryEXT> (format_info);
+
+		return query.get <vk::HostImageCopyDevicePerformanceQueryEXT> ().optimalDeviceAccess;
+	} catch (const vk::FormatNotSupportedError &) {
+		return false;
+	}
+}
+
+static bool listed(const std::vector <vk::ImageLayout> &layouts, const vk::ImageLayout &layout)
+{
+	return std::find(layouts.begin(), layouts.end(), layout) != layouts.end();
+}
+
+void Image::upload(const Device &device,
+		   StagingUploader &uploader,
+		   const void *data,
+		   size_t length,
+		   const vk::ImageLayout &layout) const
+{
+	howl_assert(length == bytes(), "image upload of {} bytes, expected {}", length, bytes());
+
+	auto &dst_layouts = device.properties.copy_dst_layouts;
+	auto &src_layouts = device.properties.copy_src_layouts;
+
+	// Host copies write in the final layout if allowed, otherwise in the
+	// general layout followed by a host transition to the final one
+	bool direct = listed(dst_layouts, layout);
+	bool indirect = listed(dst_layouts, vk::ImageLayout::eGeneral) && listed(src_layouts, layout);
+
+	if (!host_transfer || !(direct || indirect)) {
+		uploader.upload(*this, data, length, layout);
+		return;
+	}
+
+	auto copy_layout = direct ? layout : vk::ImageLayout::eGeneral;
+
+	auto range = vk::ImageSubresourceRange()
+		.setAspectMask(aspect)
+		.setBaseArrayLayer(0)
+		.setBaseMipLevel(0)
+		.setLayerCount(1)
+		.setLevelCount(1);
+
+	auto to_copy = vk::HostImageLayoutTransitionInfoEXT()
+		.setImage(handle)
+		.setOldLayout(vk::ImageLayout::eUndefined)
+		.setNewLayout(copy_layout)
+		.setSubresourceRange(range);
+
+	device.transitionImageLayoutEXT(to_copy);
+
+	auto subresource = vk::ImageSubresourceLayers()
+		.setAspectMask(aspect)
+		.setBaseArrayLayer(0)
+		.setLayerCount(1)
+		.setMipLevel(0);
+
+	auto region = vk::MemoryToImageCopyEXT()
+		.setPHostPointer(data)
+		.setImageSubresource(subresource)
+		.setImageExtent(vk::Extent3D(size, 1));
+
+	auto copy_info = vk::CopyMemoryToImageInfoEXT()
+		.setDstImage(handle)
+		.setDstImageLayout(copy_layout)
+		.setRegions(region);
+
+	device.copyMemoryToImageEXT(copy_info);
+
+	if (copy_layout != layout) {
+		auto to_final = vk::HostImageLayoutTransitionInfoEXT()
+			.setImage(handle)
+			.setOldLayout(copy_layout)
+			.setNewLayout(layout)
+			.setSubresourceRange(range);
+
+		device.transitionImageLayoutEXT(to_final);
+	}
+}
+
+void Image::upload(const Device &device,
+		   StagingUploader &uploader,
+		   const Texture &texture,
+		   const vk::ImageLayout &layout) const
+{
+	howl_assert(texture.format == format, "texture format does not match the image");
+	howl_assert(texture.width == size.width && texture.height == size.height,
+		"texture is {}x{}, image is {}x{}",
+		texture.width, texture.height, size.width, size.height);
+
+	// Levels supplied by the texture are copied as they are
+	if (texture.mip_levels > 1) {
+		uploader.upload(*this, texture.data.data(), texture.data.size(), layout, texture.mip_levels);
+		return;
+	}
+
+	upload(device, uploader, texture.data.data(), texture.data.size(), layout);
+}
+
+void Image::generate_mips(const Device &device, const vk::CommandBuffer &cmd, const vk::ImageLayout &layout) const
+{
+	auto format_properties = device.getFormatProperties(format);
+	auto features = format_properties.optimalTilingFeatures;
+
+	howl_assert((features & vk::FormatFeatureFlagBits::eBlitSrc) && (features & vk::FormatFeatureFlagBits::eBlitDst),
+		"format {} cannot be blitted to generate mips", vk::to_string(format));
+
+	auto filter = vk::Filter::eNearest;
+	if (features & vk::FormatFeatureFlagBits::eSampledImageFilterLinear)
+		filter = vk::Filter::eLinear;
+
+	auto level_range = [&](uint32_t level, uint32_t count) {
+		return vk::ImageSubresourceRange()
+			.setAspectMask(aspect)
+			.setBaseArrayLayer(0)
+			.setBaseMipLevel(level)
+			.setLayerCount(1)
+			.setLevelCount(count);
+	};
+
+	auto level_layers = [&](uint32_t level) {
+		return vk::ImageSubresourceLayers()
+			.setAspectMask(aspect)
+			.setBaseArrayLayer(0)
+			.setLayerCount(1)
+			.setMipLevel(level);
+	};
+
+	int32_t width = size.width;
+	int32_t height = size.height;
+
+	for (uint32_t i = 1; i < mip_levels; i++) {
+		// The previous level becomes the source once it has been written
+		auto to_source = vk::ImageMemoryBarrier()
+			.setImage(handle)
+			.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eTransferRead)
+			.setOldLayout(vk::ImageLayout::eTransferDstOptimal)
+			.setNewLayout(vk::ImageLayout::eTransferSrcOptimal)
+			.setSubresourceRange(level_range(i - 1, 1));
+
+		cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eTransfer,
+			{ }, { }, { }, to_source);
+
+		int32_t next_width = std::max(width / 2, 1);
+		int32_t next_height = std::max(height / 2, 1);
+
+		auto blit = vk::ImageBlit()
+			.setSrcSubresource(level_layers(i - 1))
+			.setSrcOffsets({ vk::Offset3D(0, 0, 0), vk::Offset3D(width, height, 1) })
+			.setDstSubresource(level_layers(i))
+			.setDstOffsets({ vk::Offset3D(0, 0, 0), vk::Offset3D(next_width, next_height, 1) });
+
+		cmd.blitImage(handle, vk::ImageLayout::eTransferSrcOptimal,
+			handle, vk::ImageLayout::eTransferDstOptimal,
+			blit, filter);
+
+		width = next_width;
+		height = next_height;
+	}
+
+	// Every level but the last was a blit source
+	std::vector <vk::ImageMemoryBarrier> to_final;
+
+	if (mip_levels > 1) {
+		to_final.push_back(vk::ImageMemoryBarrier()
+			.setImage(handle)
+			.setSrcAccessMask(vk::AccessFlagBits::eTransferRead)
+			.setDstAccessMask(vk::AccessFlagBits::eShaderRead)
+			.setOldLayout(vk::ImageLayout::eTransferSrcOptimal)
+			.setNewLayout(layout)
+			.setSubresourceRange(level_range(0, mip_levels - 1)));
+	}
+
+	to_final.push_back(vk::ImageMemoryBarrier()
+		.setImage(handle)
+		.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+		.setDstAccessMask(vk::AccessFlagBits::eShaderRead)
+		.setOldLayout(vk::ImageLayout::eTransferDstOptimal)
+		.setNewLayout(layout)
+		.setSubresourceRange(level_range(mip_levels - 1, 1)));
+
+	cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+		vk::PipelineStageFlagBits::eFragmentShader
+		| vk::PipelineStageFlagBits::eComputeShader,
+		{ }, { }, { }, to_final);
+}
+
+std::vector <uint8_t> Image::download(const Device &device,
+				      const DeviceResources &resources,
+				      const vk::ImageLayout &layout) const
+{
+	std::vector <uint8_t> result(bytes());
+
+	if (host_transfer && listed(device.properties.copy_src_layouts, layout)) {
+		auto subresource = vk::ImageSubresourceLayers()
+			.setAspectMask(aspect)
+			.setBaseArrayLayer(0)
+			.setLayerCount(1)
+			.setMipLevel(0);
+
+		auto region = vk::ImageToMemoryCopyEXT()
+			.setPHostPointer(result.data())
+			.setImageSubresource(subresource)
+			.setImageExtent(vk::Extent3D(size, 1));
+
+		auto copy_info = vk::CopyImageToMemoryInfoEXT()
+			.setSrcImage(handle)
+			.setSrcImageLayout(layout)
+			.setRegions(region);
+
+		device.copyImageToMemoryEXT(copy_info);
+
+		return result;
+	}
+
+	// Staged through host cached memory on the graphics queue, which
+	// owns images that are not shared between queue families
+	auto staging = Buffer::from(device,
+		result.size(),
+		vk::BufferUsageFlagBits::eTransferDst,
+		vk::MemoryPropertyFlagBits::eHostVisible,
+		vk::MemoryPropertyFlagBits::eHostCached);
+
+	auto cmd = device.allocateCommandBuffers(resources.command_pool, 1, vk::CommandBufferLevel::ePrimary).front();
+
+	cmd.begin(vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+	{
+		download(cmd, staging, layout);
+
+		auto barrier = vk::MemoryBarrier()
+			.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eHostRead);
+
+		cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eHost,
+			{ }, barrier, { }, { });
+	}
+	cmd.end();
+
+	auto point = resources.timeline.submit({ cmd });
+	resources.timeline.wait(device, point);
+
+	staging.read(device, result.data(), result.size());
+
+	device.freeCommandBuffers(resources.command_pool, cmd);
+	staging.destroy(device);
+
+	return result;
+}
+
+Image Image::unbound(const Device &device, const ImageInfo &config)
 {
 	Image result;
 
 	result.format = config.format;
+	result.size = config.size;
+	result.aspect = config.aspect;
+	result.mip_levels = config.levels();
+
+	vk::ImageUsageFlags usage = config.usage;
+	if (config.transient)
+		usage |= vk::ImageUsageFlagBits::eTransientAttachment;
+
+	// Levels are generated by blitting from one to the next
+	if (result.mip_levels > 1)
+		usage |= vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst;
+
+	auto transfers = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc;
+
+	// Mipmapped images are filled on the device, which needs no host transfers
+	bool host_copies = device.icx_features.host_image_copy && result.mip_levels == 1;
+	if (host_copies && (usage & transfers))
+		result.host_transfer = supports_host_transfer(device, config.format, usage);
+
+	if (result.host_transfer)
+		usage |= vk::ImageUsageFlagBits::eHostTransferEXT;
 
 	auto info = vk::ImageCreateInfo()
 		.setImageType(vk::ImageType::e2D)
@@ -67,36 +406,65 @@ Image Image::from(const Device &device, const ImageInfo &config)
 		.setExtent(vk::Extent3D(config.size, 1))
 		.setFormat(config.format)
 		.setInitialLayout(vk::ImageLayout::eUndefined)
-		.setMipLevels(1)
+		.setMipLevels(result.mip_levels)
 		.setSamples(config.samples)
-		.setUsage(config.usage);
+		.setUsage(usage);
+
+	// Only images filled on the transfer queue are shared, sparing them
+	// ownership transfers; exclusive images keep compression such as DCC
+	auto families = device.queueFamilies();
+	if (config.shared && families.size() > 1) {
+		info.setSharingMode(vk::SharingMode::eConcurrent)
+			.setQueueFamilyIndices(families);
+
+		result.shared = true;
+	}
 
 	result.handle = device.createImage(info);
 
-	auto memory_requirements = device.getImageMemoryRequirements(result.handle);
-	
-	result.memory = device.allocateMemoryRequirements(
-		memory_requirements,
-		vk::MemoryPropertyFlagBits::eDeviceLocal
-	);
+	return result;
+}
 
-	device.bindImageMemory(result.handle, result.memory, 0);
+void Image::bind(const Device &device, const Allocation &allocation, const ImageInfo &config)
+{
+	memory = allocation;
+
+	device.bindImageMemory(handle, memory.memory, memory.offset);
 
 	auto range = vk::ImageSubresourceRange()
 		.setAspectMask(config.aspect)
 		.setBaseArrayLayer(0)
 		.setBaseMipLevel(0)
 		.setLayerCount(1)
-		.setLevelCount(1);
+		.setLevelCount(mip_levels);
 
 	auto view_info = vk::ImageViewCreateInfo()
-		.setImage(result.handle)
+		.setImage(handle)
 		.setViewType(vk::ImageViewType::e2D)
 		.setFormat(config.format)
 		.setSubresourceRange(range);
 
-	result.view = device.createImageView(view_info);
-	result.size = config.size;
+	view = device.createImageView(view_info);
+}
+
+Image Image::from(const Device &device, const ImageInfo &config)
+{
+	auto result = Image::unbound(device, config);
+
+	auto memory_requirements = device.getImageMemoryRequirements(result.handle);
+
+	// Transient attachments may never need physical memory on tilers
+	vk::MemoryPropertyFlags preferred;
+	if (config.transient)
+		preferred = vk::MemoryPropertyFlagBits::eLazilyAllocated;
+
+	auto memory = device.allocate(
+		memory_requirements,
+		vk::MemoryPropertyFlagBits::eDeviceLocal,
+		preferred, false
+	);
+
+	result.bind(device, memory, config);
 
 	return result;
 }
@@ -108,7 +476,8 @@ Image Image::from(const Device &device, const DepthImageInfo &config)
 		.with_format(config.format)
 		.with_aspect(vk::ImageAspectFlagBits::eDepth)
 		.with_usage(vk::ImageUsageFlagBits::eDepthStencilAttachment)
-		.with_samples(config.samples);
+		.with_samples(config.samples)
+		.with_transient(config.transient);
 
 	return Image::from(device, image_info);
 }
@@ -0,0 +1,338 @@
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <mutex>
+
+#include <vulkan/vulkan_format_traits.hpp>
+
+#include <howler/howler.hpp>
+
+#ifdef OAK_BASISU
+#include <basisu_transcoder.h>
+#include <zstd.h>
+#endif
+
+#include "ktx2.hpp"
+
+namespace oak {
+
+// Data format descriptor values of interest
+static constexpr uint8_t KHR_DF_MODEL_ETC1S = 163;
+static constexpr uint8_t KHR_DF_MODEL_UASTC = 166;
+static constexpr uint8_t KHR_DF_TRANSFER_SRGB = 2;
+
+struct Descriptor {
+	uint8_t model = 0;
+	uint8_t transfer = 0;
+	std::vector <uint8_t> channels;
+};
+
+static std::vector <uint8_t> read_file(const std::filesystem::path &path)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file)
+		return { };
+
+	std::vector <uint8_t> bytes(file.tellg());
+
+	file.seekg(0);
+	file.read((char *) bytes.data(), bytes.size());
+
+	return bytes;
+}
+
+// Basic descriptor block of the data format descriptor
+static Descriptor parse_descriptor(const std::vector <uint8_t> &bytes, const KTX2::Header &header)
+{
+	Descriptor result;
+
+	// Compared subtractively, as the sum of the two could wrap
+	if (header.dfd_length < 4 + 24
+			|| header.dfd_length > bytes.size()
+			|| header.dfd_offset > bytes.size() - header.dfd_length)
+		return result;
+
+	// Skip the total size that precedes the block
+	const uint8_t *block = bytes.data() + header.dfd_offset + 4;
+
+	result.model = block[8];
+	result.transfer = block[10];
+
+	uint16_t block_size;
+	std::memcpy(&block_size, block + 6, sizeof(uint16_t));
+
+	block_size = std::min(block_size, uint16_t(header.dfd_length - 4));
+
+	for (uint32_t offset = 24; offset + 16 <= block_size; offset += 16)
+		result.channels.push_back(block[offset + 3] & 0x0F);
+
+	return result;
+}
+
+bool KTX2::valid(const std::filesystem::path &path)
+{
+	std::ifstream file(path, std::ios::binary);
+
+	uint8_t bytes[sizeof(identifier)];
+	if (!file.read((char *) bytes, sizeof(bytes)))
+		return false;
+
+	return std::memcmp(bytes, identifier, sizeof(identifier)) == 0;
+}
+
+#ifdef OAK_BASISU
+
+enum class Channels {
+	eRGB,
+	eRGBA,
+	eRG,
+};
+
+static Channels basis_channels(const Descriptor &descriptor)
+{
+	if (descriptor.channels.empty())
+		return Channels::eRGBA;
+
+	// UASTC uses one sample with a combined channel id
+	if (descriptor.model == KHR_DF_MODEL_UASTC) {
+		switch (descriptor.channels[0]) {
+		case 3:
+			return Channels::eRGBA;
+		case 5:
+		case 6:
+			return Channels::eRG;
+		default:
+			return Channels::eRGB;
+		}
+	}
+
+	// ETC1S adds a second slice for alpha or for the green channel
+	if (descriptor.channels.size() > 1) {
+		if (descriptor.channels[1] == 15)
+			return Channels::eRGBA;
+		if (descriptor.channels[1] == 4)
+			return Channels::eRG;
+	}
+
+	return Channels::eRGB;
+}
+
+static std::optional <Texture> transcode(const Device &device,
+					 const std::filesystem::path &path,
+					 const std::vector <uint8_t> &bytes,
+					 const Descriptor &descriptor)
+{
+	static std::once_flag initialized;
+	std::call_once(initialized, basist::basisu_transcoder_init);
+
+	basist::ktx2_transcoder transcoder;
+
+	if (!transcoder.init(bytes.data(), bytes.size()) || !transcoder.start_transcoding()) {
+		howl_error("failed to start transcoding {}", path.string());
+		return std::nullopt;
+	}
+
+	bool srgb = (descriptor.transfer == KHR_DF_TRANSFER_SRGB);
+
+	// ETC1S is low quality to begin with, so opaque textures take BC1;
+	// UASTC goes to BC7, which it converts to nearly losslessly
+	auto target = basist::transcoder_texture_format::cTFBC7_RGBA;
+	auto format = srgb ? vk::Format::eBc7SrgbBlock : vk::Format::eBc7UnormBlock;
+
+	switch (basis_channels(descriptor)) {
+	case Channels::eRG:
+		target = basist::transcoder_texture_format::cTFBC5_RG;
+		format = vk::Format::eBc5UnormBlock;
+		break;
+	case Channels::eRGB:
+		if (descriptor.model == KHR_DF_MODEL_ETC1S) {
+			target = basist::transcoder_texture_format::cTFBC1_RGB;
+			format = srgb ? vk::Format::eBc1RgbSrgbBlock : vk::Format::eBc1RgbUnormBlock;
+		}
+		break;
+	default:
+		break;
+	}
+
+	if (!device.getFeatures().textureCompressionBC) {
+		howl_warning("block compression is unsupported, {} is transcoded to RGBA8", path.string());
+		target = basist::transcoder_texture_format::cTFRGBA32;
+		format = srgb ? vk::Format::eR8G8B8A8Srgb : vk::Format::eR8G8B8A8Unorm;
+	}
+
+	Texture texture;
+	texture.width = transcoder.get_width();
+	texture.height = transcoder.get_height();
+	texture.format = format;
+	texture.mip_levels = std::max(transcoder.get_levels(), 1u);
+
+	bool uncompressed = basist::basis_transcoder_format_is_uncompressed(target);
+	uint32_t unit = basist::basis_get_bytes_per_block_or_pixel(target);
+
+	for (uint32_t level = 0; level < texture.mip_levels; level++) {
+		basist::ktx2_image_level_info info;
+		if (!transcoder.get_image_level_info(info, level, 0, 0)) {
+			howl_error("missing level {} in {}", level, path.string());
+			return std::nullopt;
+		}
+
+		uint32_t units = uncompressed
+			? info.m_orig_width * info.m_orig_height
+			: info.m_total_blocks;
+
+		size_t offset = texture.data.size();
+		texture.data.resize(offset + size_t(units) * unit);
+
+		if (!transcoder.transcode_image_level(level, 0, 0, texture.data.data() + offset, units, target)) {
+			howl_error("failed to transcode level {} of {}", level, path.string());
+			return std::nullopt;
+		}
+	}
+
+	return texture;
+}
+
+#endif
+
+std::optional <Texture> KTX2::load(const Device &device, const std::filesystem::path &path)
+{
+	return load(device, read_file(path), path);
+}
+
+std::optional <Texture> KTX2::load(const Device &device, const std::vector <uint8_t> &bytes, const std::filesystem::path &path)
+{
+	if (bytes.size() < sizeof(Header) || std::memcmp(bytes.data(), identifier, sizeof(identifier))) {
+		howl_error("{} is not a KTX2 file", path.string());
+		return std::nullopt;
+	}
+
+	Header header;
+	std::memcpy(&header, bytes.data(), sizeof(Header));
+
+	if (header.depth > 1 || header.layers > 1 || header.faces > 1) {
+		howl_error("{} is not a single 2D image, which is unsupported", path.string());
+		return std::nullopt;
+	}
+
+	// The level count sizes the level index, so it is bounded by the
+	// length of a full mip chain before anything is allocated
+	uint32_t chain = std::bit_width(std::max(header.width, header.height));
+
+	if (header.width == 0 || header.levels > chain) {
+		howl_error("{} has a {}x{} image with {} levels, which is invalid",
+			path.string(), header.width, header.height, header.levels);
+		return std::nullopt;
+	}
+
+	auto descriptor = parse_descriptor(bytes, header);
+
+	// Basis Universal payloads carry no Vulkan format
+	bool basis = (header.supercompression == eBasisLZ)
+		|| (descriptor.model == KHR_DF_MODEL_ETC1S)
+		|| (descriptor.model == KHR_DF_MODEL_UASTC);
+
+	if (basis) {
+#ifdef OAK_BASISU
+		return transcode(device, path, bytes, descriptor);
+#else
+		howl_error("{} needs Basis Universal transcoding, build with OAK_BASISU", path.string());
+		return std::nullopt;
+#endif
+	}
+
+	if (header.supercompression != eNone && header.supercompression != eZstandard) {
+		howl_error("unsupported supercompression scheme #{} in {}", header.supercompression, path.string());
+		return std::nullopt;
+	}
+
+	if (header.vk_format == 0) {
+		howl_error("{} has no Vulkan format", path.string());
+		return std::nullopt;
+	}
+
+	Texture texture;
+	texture.width = header.width;
+	texture.height = std::max(header.height, 1u);
+	texture.format = vk::Format(header.vk_format);
+	texture.mip_levels = std::max(header.levels, 1u);
+
+	// Covers every compression family (BC, ETC2, ASTC) as well as
+	// uncompressed formats the device lacks
+	auto properties = device.getFormatProperties(texture.format);
+	if (!(properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage)) {
+		howl_error("{} uses {}, which the device cannot sample", path.string(), vk::to_string(texture.format));
+		return std::nullopt;
+	}
+
+	// The level index follows the header
+	if (texture.mip_levels > (bytes.size() - sizeof(Header)) / sizeof(Level)) {
+		howl_error("truncated level index in {}", path.string());
+		return std::nullopt;
+	}
+
+	std::vector <Level> levels(texture.mip_levels);
+
+	std::memcpy(levels.data(), bytes.data() + sizeof(Header), levels.size() * sizeof(Level));
+
+	for (uint32_t i = 0; i < levels.size(); i++) {
+		auto &level = levels[i];
+
+		auto extent = vk::Extent2D(
+			std::max(texture.width >> i, 1u),
+			std::max(texture.height >> i, 1u));
+
+		size_t expected = Image::bytes(texture.format, extent);
+
+		if (level.length > bytes.size() || level.offset > bytes.size() - level.length) {
+			howl_error("level {} of {} lies outside the file", i, path.string());
+			return std::nullopt;
+		}
+
+		size_t offset = texture.data.size();
+		texture.data.resize(offset + expected);
+
+		if (header.supercompression == eZstandard) {
+#ifdef OAK_BASISU
+			size_t size = ZSTD_decompress(texture.data.data() + offset, expected,
+				bytes.data() + level.offset, level.length);
+
+			if (ZSTD_isError(size) || size != expected) {
+				howl_error("failed to decompress level {} of {}", i, path.string());
+				return std::nullopt;
+			}
+#else
+			howl_error("{} is Zstandard supercompressed, build with OAK_BASISU", path.string());
+			return std::nullopt;
+#endif
+		} else {
+			if (level.length != expected) {
+				howl_error("level {} of {} has {} bytes, expected {}", i, path.string(), level.length, expected);
+				return std::nullopt;
+			}
+
+			std::memcpy(texture.data.data() + offset, bytes.data() + level.offset, expected);
+		}
+	}
+
+	return texture;
+}
+
+std::vector <std::optional <Texture>> KTX2::load(const Device &device, ThreadPool &pool, const std::vector <std::filesystem::path> &paths)
+{
+	std::vector <std::future <std::optional <Texture>>> pending;
+
+	for (auto &path : paths) {
+		pending.push_back(pool.submit([&device, path]() {
+			return KTX2::load(device, path);
+		}));
+	}
+
+	std::vector <std::optional <Texture>> result;
+	for (auto &future : pending)
+		result.push_back(future.get());
+
+	return result;
+}
+
+} // namespace oak
@@ -202,4 +202,127 @@ VkResult vkCopyMemoryToImageEXT
 {
 	PFN_SETUP(vkCopyMemoryToImageEXT,
 		device, pCopyInfo);
-}
\ No newline at end of file
+}
+
+VKAPI_ATTR
+VKAPI_CALL
+VkResult vkCopyImageToMemoryEXT
+(
+	VkDevice device,
+	const VkCopyImageToMemoryInfoEXT *pCopyInfo)
+{
+	PFN_SETUP(vkCopyImageToMemoryEXT,
+		device, pCopyInfo);
+}
+
+VKAPI_ATTR
+VKAPI_CALL
+VkResult vkTransitionImageLayoutEXT
+(
+	VkDevice device,
+	uint32_t transitionCount,
+	const VkHostImageLayoutTransitionInfoEXT *pTransitions)
+{
+	PFN_SETUP(vkTransitionImageLayoutEXT,
+		device, transitionCount, pTransitions);
+}
+
+VKAPI_ATTR
+VKAPI_CALL
+void vkCmdDrawIndexedIndirectCountKHR
+(
+	VkCommandBuffer commandBuffer,
+	VkBuffer buffer,
+	VkDeviceSize offset,
+	VkBuffer countBuffer,
+	VkDeviceSize countBufferOffset,
+	uint32_t maxDrawCount,
+	uint32_t stride)
+{
+	PFN_SETUP(vkCmdDrawIndexedIndirectCountKHR,
+		commandBuffer, buffer, offset,
+		countBuffer, countBufferOffset,
+		maxDrawCount, stride);
+}
+
+VKAPI_ATTR
+VKAPI_CALL
+void vkCmdSetCullModeEXT
+(
+	VkCommandBuffer commandBuffer,
+	VkCullModeFlags cullMode
+)
+{
+	PFN_SETUP(vkCmdSetCullModeEXT,
+		commandBuffer,
+		cullMode);
+}
+
+VKAPI_ATTR
+VKAPI_CALL
+void vkCmdSetPrimitiveTopologyEXT
+(
+	VkCommandBuffer commandBuffer,
+	VkPrimitiveTopology primitiveTopology
+)
+{
+	PFN_SETUP(vkCmdSetPrimitiveTopologyEXT,
+		commandBuffer,
+		primitiveTopology);
+}
+
+VKAPI_ATTR
+VKAPI_CALL
+void vkCmdSetDepthTestEnableEXT
+(
+	VkCommandBuffer commandBuffer,
+	VkBool32 depthTestEnable
+)
+{
+	PFN_SETUP(vkCmdSetDepthTestEnableEXT,
+		commandBuffer,
+		depthTestEnable);
+}
+
+VKAPI_ATTR
+VKAPI_CALL
+void vkCmdSetDepthWriteEnableEXT
+(
+	VkCommandBuffer commandBuffer,
+	VkBool32 depthWriteEnable
+)
+{
+	PFN_SETUP(vkCmdSetDepthWriteEnableEXT,
+		commandBuffer,
+		depthWriteEnable);
+}
+
+VKAPI_ATTR
+VKAPI_CALL
+void vkCmdSetPolygonModeEXT
+(
+	VkCommandBuffer commandBuffer,
+	VkPolygonMode polygonMode
+)
+{
+	PFN_SETUP(vkCmdSetPolygonModeEXT,
+		commandBuffer,
+		polygonMode);
+}
+
+VKAPI_ATTR
+VKAPI_CALL
+void vkCmdSetColorBlendEnableEXT
+(
+	VkCommandBuffer commandBuffer,
+	uint32_t firstAttachment,
+	uint32_t attachmentCount,
+	const VkBool32 *pColorBlendEnables
+)
+{
+	PFN_SETUP(vkCmdSetColorBlendEnableEXT,
+		commandBuffer,
+		firstAttachment,
+		attachmentCount,
+		pColorBlendEnables);
+}
@@ -0,0 +1,25 @@
+#include "pipeline-batch.hpp"
+
+namespace oak {
+
+auto compile_pipelines(ThreadPool &pool,
+		       const Device &device,
+		       const std::vector <RaytracingPipeline> &rtxs,
+		       const vk::PipelineLayout &layout)
+-> std::vector <std::future <std::tuple <vk::Pipeline, ShaderBindingTable>>>
+{
+	std::vector <std::future <std::tuple <vk::Pipeline, ShaderBindingTable>>> result;
+	result.reserve(rtxs.size());
+
+	// Shader modules are loaded inside each task, so file reads and
+	// SPIR-V parsing are spread over the workers as well
+	for (const auto &rtx : rtxs) {
+		result.emplace_back(pool.submit([&device, rtx, layout]() {
+			return compile_pipeline(device, rtx, layout);
+		}));
+	}
+
+	return result;
+}
+
+} // namespace oak
@@ -0,0 +1,145 @@
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#include <howler/howler.hpp>
+
+#include "pipeline-cache.hpp"
+
+namespace oak {
+
+// 64-bit FNV-1a over the cache data
+static uint64_t checksum(const uint8_t *data, size_t size)
+{
+	uint64_t hash = 0xCBF29CE484222325ull;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 0x100000001B3ull;
+	}
+
+	return hash;
+}
+
+bool PipelineCache::save() const
+{
+	if (!handle || path.empty())
+		return false;
+
+	auto data = device.getPipelineCacheData(handle);
+
+	Header header = identity;
+	header.size = data.size();
+	header.checksum = checksum(data.data(), data.size());
+
+	std::error_code error;
+	std::filesystem::create_directories(path.parent_path(), error);
+
+	auto temporary = path;
+	temporary += ".tmp";
+
+	{
+		std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+		file.write((const char *) &header, sizeof(Header));
+		file.write((const char *) data.data(), data.size());
+
+		if (!file.good()) {
+			howl_warning("failed to write pipeline cache to {}", temporary.string());
+			return false;
+		}
+	}
+
+	std::filesystem::rename(temporary, path, error);
+	if (error) {
+		howl_warning("failed to replace pipeline cache {}: {}", path.string(), error.message());
+		std::filesystem::remove(temporary, error);
+		return false;
+	}
+
+	howl_info("saved {} KiB of pipeline cache to {}", data.size() >> 10, path.string());
+
+	return true;
+}
+
+void PipelineCache::destroy() const
+{
+	if (handle)
+		device.destroyPipelineCache(handle);
+}
+
+std::filesystem::path PipelineCache::default_path()
+{
+	if (const char *env = std::getenv("OAK_PIPELINE_CACHE"))
+		return env;
+
+	if (const char *xdg = std::getenv("XDG_CACHE_HOME"))
+		return std::filesystem::path(xdg) / "oak" / "pipelines.bin";
+
+	if (const char *home = std::getenv("HOME"))
+		return std::filesystem::path(home) / ".cache" / "oak" / "pipelines.bin";
+
+	return ".oak-pipelines.bin";
+}
+
+PipelineCache PipelineCache::load(const vk::PhysicalDevice &phdev, const vk::Device &device, const std::filesystem::path &path)
+{
+	auto properties = phdev.getProperties();
+
+	PipelineCache result;
+	result.device = device;
+	result.path = path;
+
+	result.identity.magic = magic;
+	result.identity.version = version;
+	result.identity.vendor = properties.vendorID;
+	result.identity.device = properties.deviceID;
+	result.identity.driver = properties.driverVersion;
+	std::memcpy(result.identity.uuid, properties.pipelineCacheUUID.data(), VK_UUID_SIZE);
+
+	std::vector <uint8_t> data;
+
+	std::ifstream file(path, std::ios::binary);
+	if (file) {
+		Header header;
+		file.read((char *) &header, sizeof(Header));
+
+		bool same = file.good()
+			&& header.magic == magic
+			&& header.version == version
+			&& header.vendor == properties.vendorID
+			&& header.device == properties.deviceID
+			&& header.driver == properties.driverVersion
+			&& !std::memcmp(header.uuid, properties.pipelineCacheUUID.data(), VK_UUID_SIZE);
+
+		// The stored size is only trusted as far as the file goes
+		std::error_code error;
+		uint64_t length = std::filesystem::file_size(path, error);
+		bool fits = !error && length >= sizeof(Header) && header.size <= length - sizeof(Header);
+
+		if (same && !fits) {
+			howl_warning("pipeline cache {} is truncated, starting empty", path.string());
+		} else if (same) {
+			data.resize(header.size);
+			file.read((char *) data.data(), data.size());
+
+			if (!file.good() || checksum(data.data(), data.size()) != header.checksum) {
+				howl_warning("pipeline cache {} is corrupt, starting empty", path.string());
+				data.clear();
+			}
+		} else {
+			howl_warning("pipeline cache {} is from another device or driver, starting empty", path.string());
+		}
+	}
+
+	auto info = vk::PipelineCacheCreateInfo()
+		.setInitialDataSize(data.size())
+		.setPInitialData(data.empty() ? nullptr : data.data());
+
+	result.handle = device.createPipelineCache(info);
+
+	if (data.size())
+		howl_info("loaded {} KiB of pipeline cache from {}", data.size() >> 10, path.string());
+
+	return result;
+}
+
+} // namespace oak
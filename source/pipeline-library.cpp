@@ -0,0 +1,125 @@
+#include <array>
+
+#include "pipeline-library.hpp"
+
+namespace oak {
+
+using Part = vk::GraphicsPipelineLibraryFlagBitsEXT;
+
+// Creates, or finds, the library for one part of a pipeline description,
+// with only the state belonging to that part
+static vk::Pipeline library(const Device &device, const vk::GraphicsPipelineCreateInfo &info, Part part)
+{
+	auto library_info = vk::GraphicsPipelineLibraryCreateInfoEXT()
+		.setFlags(part);
+
+	// Optimized links need the libraries to keep their intermediate form
+	auto part_info = vk::GraphicsPipelineCreateInfo()
+		.setFlags(vk::PipelineCreateFlagBits::eLibraryKHR
+			| vk::PipelineCreateFlagBits::eRetainLinkTimeOptimizationInfoEXT)
+		.setPDynamicState(info.pDynamicState)
+		.setPNext(&library_info);
+
+	std::vector <vk::PipelineShaderStageCreateInfo> stages;
+
+	auto fragment = [](const vk::PipelineShaderStageCreateInfo &stage) {
+		return stage.stage == vk::ShaderStageFlagBits::eFragment;
+	};
+
+	switch (part) {
+	case Part::eVertexInputInterface:
+		part_info
+			.setPVertexInputState(info.pVertexInputState)
+			.setPInputAssemblyState(info.pInputAssemblyState);
+		break;
+	case Part::ePreRasterizationShaders:
+		for (uint32_t i = 0; i < info.stageCount; i++) {
+			if (!fragment(info.pStages[i]))
+				stages.push_back(info.pStages[i]);
+		}
+
+		part_info
+			.setStages(stages)
+			.setPViewportState(info.pViewportState)
+			.setPRasterizationState(info.pRasterizationState)
+			.setPTessellationState(info.pTessellationState)
+			.setLayout(info.layout)
+			.setRenderPass(info.renderPass)
+			.setSubpass(info.subpass);
+		break;
+	case Part::eFragmentShader:
+		for (uint32_t i = 0; i < info.stageCount; i++) {
+			if (fragment(info.pStages[i]))
+				stages.push_back(info.pStages[i]);
+		}
+
+		part_info
+			.setStages(stages)
+			.setPDepthStencilState(info.pDepthStencilState)
+			.setPMultisampleState(info.pMultisampleState)
+			.setLayout(info.layout)
+			.setRenderPass(info.renderPass)
+			.setSubpass(info.subpass);
+		break;
+	case Part::eFragmentOutputInterface:
+		part_info
+			.setPColorBlendState(info.pColorBlendState)
+			.setPMultisampleState(info.pMultisampleState)
+			.setRenderPass(info.renderPass)
+			.setSubpass(info.subpass);
+		break;
+	}
+
+	return device.pipeline_registry->graphicsPipeline(device.pipelineCache(), part_info);
+}
+
+LinkedPipeline link_pipeline(const Device &device, const vk::GraphicsPipelineCreateInfo &info)
+{
+	auto &registry = *device.pipeline_registry;
+	auto cache = device.pipelineCache();
+
+	std::array <vk::Pipeline, 4> libraries {
+		library(device, info, Part::eVertexInputInterface),
+		library(device, info, Part::ePreRasterizationShaders),
+		library(device, info, Part::eFragmentShader),
+		library(device, info, Part::eFragmentOutputInterface),
+	};
+
+	auto library_info = vk::PipelineLibraryCreateInfoKHR()
+		.setLibraries(libraries);
+
+	auto link_info = vk::GraphicsPipelineCreateInfo()
+		.setLayout(info.layout)
+		.setPNext(&library_info);
+
+	auto optimized_info = link_info;
+	optimized_info.setFlags(vk::PipelineCreateFlagBits::eLinkTimeOptimizationEXT);
+
+	LinkedPipeline result;
+
+	// Parts linked before may have been optimized already
+	if (auto pipeline = registry.find(optimized_info)) {
+		result.handle = *pipeline;
+		return result;
+	}
+
+	result.handle = registry.graphicsPipeline(cache, link_info);
+
+	auto optimize = [&registry, cache, libraries, layout = info.layout]() {
+		auto library_info = vk::PipelineLibraryCreateInfoKHR()
+			.setLibraries(libraries);
+
+		auto link_info = vk::GraphicsPipelineCreateInfo()
+			.setFlags(vk::PipelineCreateFlagBits::eLinkTimeOptimizationEXT)
+			.setLayout(layout)
+			.setPNext(&library_info);
+
+		return registry.graphicsPipeline(cache, link_info);
+	};
+
+	result.optimized = registry.worker().submit(optimize).share();
+
+	return result;
+}
+
+} // namespace oak
@@ -0,0 +1,410 @@
+#include <cstring>
+
+#include <howler/howler.hpp>
+
+#include "pipeline-registry.hpp"
+
+namespace oak {
+
+// Serialized creation state, written field by field so that padding never
+// reaches it; the whole of it is the key, so equal keys are equal state
+struct KeyWriter {
+	std::string bytes;
+
+	void write(const void *data, size_t size) {
+		bytes.append((const char *) data, size);
+	}
+
+	template <typename T>
+	requires std::is_trivially_copyable_v <T>
+	void operator()(const T &x) {
+		write(&x, sizeof(T));
+	}
+
+	void string(const char *s) {
+		if (s)
+			write(s, std::strlen(s) + 1);
+		else
+			(*this)(uint8_t(0));
+	}
+
+	// Structures chained to a create info; an unknown one would make
+	// different state produce the same key, so those are refused outright
+	void chain(const void *next) {
+		for (auto base = (const vk::BaseInStructure *) next; base; base = base->pNext) {
+			(*this)(base->sType);
+
+			switch (base->sType) {
+			case vk::StructureType::eDescriptorSetLayoutBindingFlagsCreateInfo:
+			{
+				auto info = (const vk::DescriptorSetLayoutBindingFlagsCreateInfo *) base;
+				(*this)(info->bindingCount);
+				for (uint32_t i = 0; i < info->bindingCount; i++)
+					(*this)(info->pBindingFlags[i]);
+				break;
+			}
+			case vk::StructureType::eGraphicsPipelineLibraryCreateInfoEXT:
+			{
+				auto info = (const vk::GraphicsPipelineLibraryCreateInfoEXT *) base;
+				(*this)(info->flags);
+				break;
+			}
+			case vk::StructureType::ePipelineLibraryCreateInfoKHR:
+			{
+				auto info = (const vk::PipelineLibraryCreateInfoKHR *) base;
+				(*this)(info->libraryCount);
+				for (uint32_t i = 0; i < info->libraryCount; i++)
+					(*this)(info->pLibraries[i]);
+				break;
+			}
+			default:
+				howl_fatal("pipeline registry cannot key {}", vk::to_string(base->sType));
+			}
+		}
+	}
+};
+
+std::string PipelineRegistry::key(const vk::DescriptorSetLayoutCreateInfo &info)
+{
+	KeyWriter writer;
+	writer(info.flags);
+	writer.chain(info.pNext);
+
+	writer(info.bindingCount);
+	for (uint32_t i = 0; i < info.bindingCount; i++) {
+		auto &binding = info.pBindings[i];
+		writer(binding.binding);
+		writer(binding.descriptorType);
+		writer(binding.descriptorCount);
+		writer(binding.stageFlags);
+
+		bool immutable = binding.pImmutableSamplers;
+		writer(immutable);
+
+		if (immutable) {
+			for (uint32_t j = 0; j < binding.descriptorCount; j++)
+				writer(binding.pImmutableSamplers[j]);
+		}
+	}
+
+	return writer.bytes;
+}
+
+std::string PipelineRegistry::key(const vk::PipelineLayoutCreateInfo &info)
+{
+	KeyWriter writer;
+	writer(info.flags);
+	writer.chain(info.pNext);
+
+	writer(info.setLayoutCount);
+	for (uint32_t i = 0; i < info.setLayoutCount; i++)
+		writer(info.pSetLayouts[i]);
+
+	writer(info.pushConstantRangeCount);
+	for (uint32_t i = 0; i < info.pushConstantRangeCount; i++) {
+		auto &range = info.pPushConstantRanges[i];
+		writer(range.stageFlags);
+		writer(range.offset);
+		writer(range.size);
+	}
+
+	return writer.bytes;
+}
+
+std::string PipelineRegistry::key(const vk::GraphicsPipelineCreateInfo &info)
+{
+	KeyWriter writer;
+	writer(info.flags);
+	writer.chain(info.pNext);
+
+	// Shaders
+	writer(info.stageCount);
+	for (uint32_t i = 0; i < info.stageCount; i++) {
+		auto &stage = info.pStages[i];
+		writer.chain(stage.pNext);
+		writer(stage.flags);
+		writer(stage.stage);
+		writer(stage.module);
+		writer.string(stage.pName);
+
+		bool specialized = stage.pSpecializationInfo;
+		writer(specialized);
+
+		if (specialized) {
+			auto &specialization = *stage.pSpecializationInfo;
+
+			writer(specialization.mapEntryCount);
+			for (uint32_t j = 0; j < specialization.mapEntryCount; j++) {
+				auto &entry = specialization.pMapEntries[j];
+				writer(entry.constantID);
+				writer(entry.offset);
+				writer(entry.size);
+			}
+
+			writer(specialization.dataSize);
+			writer.write(specialization.pData, specialization.dataSize);
+		}
+	}
+
+	// Fixed function state; absent state writes a marker alone
+	auto present = [&](const void *ptr) {
+		writer(bool(ptr));
+		return ptr != nullptr;
+	};
+
+	if (present(info.pVertexInputState)) {
+		auto &state = *info.pVertexInputState;
+		writer.chain(state.pNext);
+
+		writer(state.vertexBindingDescriptionCount);
+		for (uint32_t i = 0; i < state.vertexBindingDescriptionCount; i++) {
+			auto &binding = state.pVertexBindingDescriptions[i];
+			writer(binding.binding);
+			writer(binding.stride);
+			writer(binding.inputRate);
+		}
+
+		writer(state.vertexAttributeDescriptionCount);
+		for (uint32_t i = 0; i < state.vertexAttributeDescriptionCount; i++) {
+			auto &attribute = state.pVertexAttributeDescriptions[i];
+			writer(attribute.location);
+			writer(attribute.binding);
+			writer(attribute.format);
+			writer(attribute.offset);
+		}
+	}
+
+	if (present(info.pInputAssemblyState)) {
+		auto &state = *info.pInputAssemblyState;
+		writer.chain(state.pNext);
+		writer(state.topology);
+		writer(state.primitiveRestartEnable);
+	}
+
+	if (present(info.pTessellationState)) {
+		auto &state = *info.pTessellationState;
+		writer.chain(state.pNext);
+		writer(state.patchControlPoints);
+	}
+
+	if (present(info.pViewportState)) {
+		auto &state = *info.pViewportState;
+		writer.chain(state.pNext);
+		writer(state.viewportCount);
+		writer(state.scissorCount);
+
+		// Null when the viewports and scissors are dynamic
+		if (present(state.pViewports)) {
+			for (uint32_t i = 0; i < state.viewportCount; i++)
+				writer(state.pViewports[i]);
+		}
+
+		if (present(state.pScissors)) {
+			for (uint32_t i = 0; i < state.scissorCount; i++)
+				writer(state.pScissors[i]);
+		}
+	}
+
+	if (present(info.pRasterizationState)) {
+		auto &state = *info.pRasterizationState;
+		writer.chain(state.pNext);
+		writer(state.depthClampEnable);
+		writer(state.rasterizerDiscardEnable);
+		writer(state.polygonMode);
+		writer(state.cullMode);
+		writer(state.frontFace);
+		writer(state.depthBiasEnable);
+		writer(state.depthBiasConstantFactor);
+		writer(state.depthBiasClamp);
+		writer(state.depthBiasSlopeFactor);
+		writer(state.lineWidth);
+	}
+
+	if (present(info.pMultisampleState)) {
+		auto &state = *info.pMultisampleState;
+		writer.chain(state.pNext);
+		writer(state.rasterizationSamples);
+		writer(state.sampleShadingEnable);
+		writer(state.minSampleShading);
+		writer(state.alphaToCoverageEnable);
+		writer(state.alphaToOneEnable);
+
+		if (present(state.pSampleMask)) {
+			uint32_t words = (uint32_t(state.rasterizationSamples) + 31) / 32;
+			for (uint32_t i = 0; i < words; i++)
+				writer(state.pSampleMask[i]);
+		}
+	}
+
+	if (present(info.pDepthStencilState)) {
+		auto &state = *info.pDepthStencilState;
+		writer.chain(state.pNext);
+		writer(state.flags);
+		writer(state.depthTestEnable);
+		writer(state.depthWriteEnable);
+		writer(state.depthCompareOp);
+		writer(state.depthBoundsTestEnable);
+		writer(state.stencilTestEnable);
+
+		for (auto &op : { state.front, state.back }) {
+			writer(op.failOp);
+			writer(op.passOp);
+			writer(op.depthFailOp);
+			writer(op.compareOp);
+			writer(op.compareMask);
+			writer(op.writeMask);
+			writer(op.reference);
+		}
+
+		writer(state.minDepthBounds);
+		writer(state.maxDepthBounds);
+	}
+
+	if (present(info.pColorBlendState)) {
+		auto &state = *info.pColorBlendState;
+		writer.chain(state.pNext);
+		writer(state.flags);
+		writer(state.logicOpEnable);
+		writer(state.logicOp);
+
+		writer(state.attachmentCount);
+		for (uint32_t i = 0; i < state.attachmentCount; i++) {
+			auto &attachment = state.pAttachments[i];
+			writer(attachment.blendEnable);
+			writer(attachment.srcColorBlendFactor);
+			writer(attachment.dstColorBlendFactor);
+			writer(attachment.colorBlendOp);
+			writer(attachment.srcAlphaBlendFactor);
+			writer(attachment.dstAlphaBlendFactor);
+			writer(attachment.alphaBlendOp);
+			writer(attachment.colorWriteMask);
+		}
+
+		for (float constant : state.blendConstants)
+			writer(constant);
+	}
+
+	if (present(info.pDynamicState)) {
+		auto &state = *info.pDynamicState;
+		writer.chain(state.pNext);
+
+		writer(state.dynamicStateCount);
+		for (uint32_t i = 0; i < state.dynamicStateCount; i++)
+			writer(state.pDynamicStates[i]);
+	}
+
+	// Interface; layouts come from the registry as well, so equal
+	// layouts already share a handle
+	writer(info.layout);
+	writer(info.renderPass);
+	writer(info.subpass);
+	writer(info.basePipelineHandle);
+	writer(info.basePipelineIndex);
+
+	return writer.bytes;
+}
+
+// Looks up a handle, creating it outside the lock on a miss
+template <typename T, typename Create, typename Destroy>
+static T intern(PipelineRegistry &registry,
+		std::unordered_map <std::string, T> &map,
+		const std::string &key,
+		const Create &create,
+		const Destroy &destroy)
+{
+	{
+		std::lock_guard guard(registry.lock);
+
+		auto it = map.find(key);
+		if (it != map.end()) {
+			registry.stats.hits++;
+			return it->second;
+		}
+	}
+
+	T handle = create();
+
+	std::lock_guard guard(registry.lock);
+
+	auto [it, inserted] = map.try_emplace(key, handle);
+	if (inserted) {
+		registry.stats.misses++;
+	} else {
+		registry.stats.hits++;
+		destroy(handle);
+	}
+
+	return it->second;
+}
+
+vk::DescriptorSetLayout PipelineRegistry::descriptorSetLayout(const vk::DescriptorSetLayoutCreateInfo &info)
+{
+	return intern(*this, set_layouts, key(info),
+		[&]() { return device.createDescriptorSetLayout(info); },
+		[&](const vk::DescriptorSetLayout &dsl) { device.destroyDescriptorSetLayout(dsl); });
+}
+
+vk::PipelineLayout PipelineRegistry::pipelineLayout(const vk::PipelineLayoutCreateInfo &info)
+{
+	return intern(*this, layouts, key(info),
+		[&]() { return device.createPipelineLayout(info); },
+		[&](const vk::PipelineLayout &layout) { device.destroyPipelineLayout(layout); });
+}
+
+vk::Pipeline PipelineRegistry::graphicsPipeline(const vk::PipelineCache &cache, const vk::GraphicsPipelineCreateInfo &info)
+{
+	return intern(*this, pipelines, key(info),
+		[&]() { return device.createGraphicsPipelines(cache, info).value.front(); },
+		[&](const vk::Pipeline &pipeline) { device.destroyPipeline(pipeline); });
+}
+
+std::optional <vk::Pipeline> PipelineRegistry::find(const vk::GraphicsPipelineCreateInfo &info)
+{
+	auto state = key(info);
+
+	std::lock_guard guard(lock);
+
+	auto it = pipelines.find(state);
+	if (it == pipelines.end())
+		return std::nullopt;
+
+	return it->second;
+}
+
+ThreadPool &PipelineRegistry::worker()
+{
+	std::lock_guard guard(lock);
+
+	if (!linker)
+		linker = std::make_unique <ThreadPool> (1);
+
+	return *linker;
+}
+
+void PipelineRegistry::join()
+{
+	// Pending work registers pipelines, so it has to finish unlocked
+	linker.reset();
+}
+
+void PipelineRegistry::destroy()
+{
+	join();
+
+	std::lock_guard guard(lock);
+
+	for (auto &[_, pipeline] : pipelines)
+		device.destroyPipeline(pipeline);
+
+	for (auto &[_, layout] : layouts)
+		device.destroyPipelineLayout(layout);
+
+	for (auto &[_, dsl] : set_layouts)
+		device.destroyDescriptorSetLayout(dsl);
+
+	pipelines.clear();
+	layouts.clear();
+	set_layouts.clear();
+}
+
+} // namespace oak
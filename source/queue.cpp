@@ -2,9 +2,28 @@
 
 namespace oak {
 
+std::shared_ptr <std::mutex> QueueLocks::get(const vk::Queue &queue)
+{
+	std::lock_guard guard(mutex);
+
+	auto &lock = locks[queue];
+	if (!lock)
+		lock = std::make_shared <std::mutex> ();
+
+	return lock;
+}
+
 // Queue methods
 Queue::Queue(const vk::Queue &queue) : vk::Queue(queue) {}
 
+std::unique_lock <std::mutex> Queue::acquire() const
+{
+	if (lock)
+		return std::unique_lock(*lock);
+
+	return {};
+}
+
 void Queue::submit(const std::vector <vk::CommandBuffer> &commands,
 			   const std::vector <vk::Semaphore> &wait,
 			   const std::vector <vk::Semaphore> &signal,
@@ -19,15 +38,10 @@ void Queue::submit(const std::vector <vk::CommandBuffer> &commands,
 			.setSignalSemaphores(signal)
 			.setSignalSemaphoreCount(signal.size());
 
+		auto guard = acquire();
 		vk::Queue::submit(submit_info, fence);
 }
 
-void Queue::submitAndWait(const std::vector <vk::CommandBuffer> &commands) const
-{
-		submit(commands, { }, { }, nullptr, vk::PipelineStageFlagBits::eNone);
-		waitIdle();
-}
-
 SwapchainStatus Queue::present(const vk::SwapchainKHR &swapchain, const std::vector <vk::Semaphore> &wait, uint32_t index) const
 {
 		auto present_info = vk::PresentInfoKHR()
@@ -39,6 +53,7 @@ SwapchainStatus Queue::present(const vk::SwapchainKHR &swapchain, const std::vec
 		vk::Result present_result;
 
 		try {
+			auto guard = acquire();
 			present_result = presentKHR(present_info);
 		} catch (const vk::OutOfDateKHRError &) {
 			return eOutOfDate;
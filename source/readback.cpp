@@ -0,0 +1,119 @@
+#include <howler/howler.hpp>
+
+#include "readback.hpp"
+
+namespace oak {
+
+// Readback methods
+bool Readback::ready(const Device &device) const
+{
+	return timeline.reached(device, point);
+}
+
+void Readback::wait(const Device &device) const
+{
+	timeline.wait(device, point);
+}
+
+// Ring methods
+void ReadbackRing::reclaim(uint32_t frame_, const GpuTimeline &timeline_, uint64_t point_)
+{
+	frame = frame_ % frames;
+	cursor = 0;
+	timeline = timeline_;
+	point = point_;
+}
+
+static void host_barrier(const vk::CommandBuffer &cmd)
+{
+	auto barrier = vk::MemoryBarrier()
+		.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+		.setDstAccessMask(vk::AccessFlagBits::eHostRead);
+
+	cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+		vk::PipelineStageFlagBits::eHost,
+		{ }, barrier, { }, { });
+}
+
+Readback ReadbackRing::download(const vk::CommandBuffer &cmd, const Buffer &source, size_t offset, size_t size)
+{
+	howl_assert(cursor + size <= partition,
+		"readback ring partition exhausted ({} + {} > {} bytes)",
+		cursor, size, partition);
+
+	Readback result;
+	result.buffer = buffer;
+	result.offset = frame * partition + cursor;
+	result.size = size;
+	result.timeline = timeline;
+	result.point = point;
+
+	auto region = vk::BufferCopy()
+		.setSrcOffset(offset)
+		.setDstOffset(result.offset)
+		.setSize(size);
+
+	cmd.copyBuffer(source.handle, buffer.handle, region);
+	host_barrier(cmd);
+
+	cursor = (cursor + size + 15) & ~size_t(15);
+
+	return result;
+}
+
+Readback ReadbackRing::download(const vk::CommandBuffer &cmd,
+				const Image &image,
+				const vk::ImageLayout &layout,
+				const vk::PipelineStageFlags &begin,
+				const vk::PipelineStageFlags &end,
+				const vk::AccessFlags &written)
+{
+	size_t size = image.bytes();
+
+	howl_assert(cursor + size <= partition,
+		"readback ring partition exhausted ({} + {} > {} bytes)",
+		cursor, size, partition);
+
+	Readback result;
+	result.buffer = buffer;
+	result.offset = frame * partition + cursor;
+	result.size = size;
+	result.timeline = timeline;
+	result.point = point;
+
+	image.download(cmd, buffer, result.offset, layout, begin, end, written);
+	host_barrier(cmd);
+
+	cursor = (cursor + size + 15) & ~size_t(15);
+
+	return result;
+}
+
+void ReadbackRing::destroy(const Device &device) const
+{
+	buffer.destroy(device);
+}
+
+ReadbackRing ReadbackRing::from(const Device &device, size_t frames, size_t partition)
+{
+	ReadbackRing result;
+
+	result.frames = frames;
+	result.partition = (partition + 255) & ~size_t(255);
+
+	// Cached memory makes large CPU reads fast; it is often not
+	// coherent, which is why readbacks invalidate their own ranges
+	result.buffer = Buffer::from(device,
+		frames * result.partition,
+		vk::BufferUsageFlagBits::eTransferDst,
+		vk::MemoryPropertyFlagBits::eHostVisible,
+		vk::MemoryPropertyFlagBits::eHostCached);
+
+	result.buffer.persist(device);
+
+	device.name(result.buffer, "readback ring");
+
+	return result;
+}
+
+} // namespace oak
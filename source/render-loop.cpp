@@ -2,6 +2,8 @@
 
 #include "render-loop.hpp"
 #include "sync.hpp"
+#include "readback.hpp"
+#include "transient.hpp"
 
 namespace oak {
 
@@ -18,23 +20,40 @@ void RenderLoopBuilder::launch()
 	for (auto &cmd : commands)
 		deallocator.collect(cmd, resources.command_pool);
 
-	auto sync = PrimarySynchronization::from(device, window.images.size());
+	auto sync = PrimarySynchronization::from(device, resources.queue, window.images.size());
 	deallocator.collect(sync);
 
+	if (transient) {
+		howl_assert(transient->frames == window.images.size(),
+			"transient ring has {} partitions, expected {}",
+			transient->frames, window.images.size());
+	}
+
+	if (readback) {
+		howl_assert(readback->frames == window.images.size(),
+			"readback ring has {} partitions, expected {}",
+			readback->frames, window.images.size());
+	}
+
 	uint32_t frame = 0;
 
 	SwapchainStatus status;
 	uint32_t image_index;
-	bool skip_reset = false;
 
 	while (!glfwWindowShouldClose(window.glfw)) {
 		glfwPollEvents();
 
-		// In case acquire failed in the previous frame
-		if (skip_reset)
-			skip_reset = false;
-		else
-			device.waitAndReset(sync.processing[frame]);
+		// Waiting again after a failed acquire returns immediately
+		sync.timeline.wait(device, sync.points[frame]);
+
+		// The frame's previous submission has retired
+		if (transient)
+			transient->reclaim(frame);
+
+		// Only this loop submits on its timeline, so the
+		// frame's submission will signal the next point
+		if (readback)
+			readback->reclaim(frame, sync.timeline, sync.timeline.submitted() + 1);
 
 		std::tie(status, image_index) = device.acquireNextImage(window.swapchain, sync.available[frame]);
 
@@ -48,7 +67,6 @@ void RenderLoopBuilder::launch()
 			if (resizer)
 				resizer.value()();
 
-			skip_reset = true;
 			continue;
 		} else if (status == eFaulty) {
 			howl_error("failed to present swapchain");
@@ -63,12 +81,16 @@ void RenderLoopBuilder::launch()
 		}
 		cmd.end();
 
+		if (transient)
+			transient->flush(device);
+
 		// Submit and present
-		resources.queue.submit({ cmd },
-			{ sync.available[frame] },
-			{ sync.finished[frame] },
-			sync.processing[frame],
-			vk::PipelineStageFlagBits::eColorAttachmentOutput);
+		auto acquired = GpuDependency {
+			sync.available[frame], 0,
+			vk::PipelineStageFlagBits::eColorAttachmentOutput
+		};
+
+		sync.points[frame] = sync.timeline.submit({ cmd }, { acquired }, { sync.finished[frame] });
 
 		status = resources.queue.present(window.swapchain, { sync.finished[frame] }, image_index);
 
@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <cmath>
+#include <queue>
+
+#include <howler/howler.hpp>
+
+#include "residency.hpp"
+
+namespace oak {
+
+void TextureResidency::sample(Handle handle, float pixels)
+{
+	handle = loader.resolve(handle);
+
+	if (usage.size() <= handle)
+		usage.resize(handle + 1);
+
+	// Textures shared between several draws take the largest coverage
+	auto &use = usage[handle];
+	if (use.last_sampled == frame)
+		use.pixels = std::max(use.pixels, pixels);
+	else
+		use.pixels = pixels;
+
+	use.last_sampled = frame;
+}
+
+void TextureResidency::update()
+{
+	usage.resize(loader.entries.size());
+
+	struct Candidate {
+		Handle handle;
+		uint32_t base;
+	};
+
+	std::vector <Candidate> sampled;
+	std::vector <Candidate> unsampled;
+
+	size_t total = 0;
+
+	for (Handle handle = 0; handle < loader.entries.size(); handle++) {
+		auto &entry = loader.entries[handle];
+
+		// Textures still loading for the first time have no known size
+		if (loader.resolve(handle) != handle || entry.levels == 0)
+			continue;
+
+		if (entry.state == TextureLoader::State::eFailed)
+			continue;
+
+		// Untouched textures keep their target unless evicted
+		Candidate candidate { handle, entry.target };
+
+		if (usage[handle].last_sampled == frame) {
+			candidate.base = entry.streamable
+				? std::min(level(entry.extent, usage[handle].pixels), entry.levels - 1)
+				: 0;
+
+			sampled.push_back(candidate);
+		} else {
+			unsampled.push_back(candidate);
+		}
+
+		total += loader.bytes(handle, candidate.base);
+	}
+
+	// Least recently sampled go first
+	std::sort(unsampled.begin(), unsampled.end(),
+		[&](const Candidate &a, const Candidate &b) {
+			return usage[a.handle].last_sampled < usage[b.handle].last_sampled;
+		});
+
+	for (auto &candidate : unsampled) {
+		if (total <= budget)
+			break;
+
+		total -= loader.bytes(candidate.handle, candidate.base);
+		candidate.base = loader.entries[candidate.handle].levels;
+	}
+
+	// Then the finest level of whichever sampled texture frees the most,
+	// always keeping at least the smallest level of those
+	auto saving = [&](const Candidate &candidate) {
+		return loader.bytes(candidate.handle, candidate.base)
+			- loader.bytes(candidate.handle, candidate.base + 1);
+	};
+
+	auto coarsens = [&](const Candidate &candidate) {
+		auto &entry = loader.entries[candidate.handle];
+		return entry.streamable && candidate.base + 1 < entry.levels;
+	};
+
+	std::priority_queue <std::pair <size_t, size_t>> savings;
+	for (size_t i = 0; i < sampled.size(); i++) {
+		if (coarsens(sampled[i]))
+			savings.emplace(saving(sampled[i]), i);
+	}
+
+	while (total > budget && !savings.empty()) {
+		auto [bytes, i] = savings.top();
+		savings.pop();
+
+		total -= bytes;
+		sampled[i].base++;
+
+		if (coarsens(sampled[i]))
+			savings.emplace(saving(sampled[i]), i);
+	}
+
+	if (total > budget && !exceeded) {
+		howl_warning("textures in view need {} MiB, over the {} MiB budget",
+			total >> 20, budget >> 20);
+	}
+
+	exceeded = (total > budget);
+
+	for (auto &candidate : sampled)
+		loader.stream(candidate.handle, candidate.base);
+
+	for (auto &candidate : unsampled)
+		loader.stream(candidate.handle, candidate.base);
+
+	frame++;
+}
+
+size_t TextureResidency::used() const
+{
+	size_t result = 0;
+	for (Handle handle = 0; handle < loader.entries.size(); handle++) {
+		if (loader.resolve(handle) == handle)
+			result += loader.bytes(handle);
+	}
+
+	return result;
+}
+
+uint32_t TextureResidency::level(const vk::Extent2D &extent, float pixels)
+{
+	float texels = std::max(extent.width, extent.height);
+	if (pixels >= texels)
+		return 0;
+
+	// One texel per pixel, with every level halving the texels
+	return uint32_t(std::log2(texels / std::max(pixels, 1.0f)));
+}
+
+} // namespace oak
@@ -72,7 +72,7 @@ std::tuple <vk::Pipeline, ShaderBindingTable> compile_pipeline(const Device &dev
 		.setMaxPipelineRayRecursionDepth(1)
 		.setLayout(layout);
 
-	auto pipeline = device.createRayTracingPipelineKHR(nullptr, { }, pipeline_info).value;
+	auto pipeline = device.createRayTracingPipelineKHR(nullptr, device.pipelineCache(), pipeline_info).value;
 
 	// Prepare the shader binding table
 	ShaderBindingTable sbt;
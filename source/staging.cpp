@@ -0,0 +1,316 @@
+#include <algorithm>
+#include <numeric>
+
+#include <vulkan/vulkan_format_traits.hpp>
+
+#include <howler/howler.hpp>
+
+#include "staging.hpp"
+
+namespace oak {
+
+// Whether the transfer queue shares the graphics family, in which case
+// exclusive resources need no ownership transfers either
+static bool transfer_on_graphics(const Device &device)
+{
+	return device.queues.transfer.family == device.queues.graphics.family;
+}
+
+StagingUploader::StagingUploader(const Device &device_, const DeviceResources &resources)
+		: device(device_),
+		timeline(resources.transfer_timeline),
+		command_pool(resources.transfer_pool),
+		graphics_timeline(resources.timeline),
+		graphics_pool(device_.createCommandPool(resources.queue))
+{
+	cmd = device.allocateCommandBuffers(command_pool, 1, vk::CommandBufferLevel::ePrimary).front();
+	graphics_cmd = device.allocateCommandBuffers(graphics_pool, 1, vk::CommandBufferLevel::ePrimary).front();
+}
+
+std::pair <uint32_t, size_t> StagingUploader::stage(const void *data, size_t size, size_t alignment)
+{
+	// Staging memory of an in-flight submission cannot be overwritten
+	if (pending)
+		wait();
+
+	cursor = (cursor + alignment - 1) & ~(alignment - 1);
+
+	if (chunks.empty() || cursor + size > chunks[chunk].size) {
+		if (chunks.size())
+			chunk++;
+
+		cursor = 0;
+
+		// Chunks past the current one are unused in this batch, so
+		// any too small for this request are dropped until one fits
+		while (chunk < chunks.size() && chunks[chunk].size < size) {
+			chunks[chunk].destroy(device);
+			chunks.erase(chunks.begin() + chunk);
+		}
+
+		if (chunk >= chunks.size()) {
+			auto buffer = Buffer::from(device,
+				std::max(size, chunk_size),
+				vk::BufferUsageFlagBits::eTransferSrc);
+
+			device.name(buffer, fmt::format("staging[{}]", chunks.size()));
+
+			chunks.insert(chunks.begin() + chunk, buffer.persist(device));
+		}
+	}
+
+	auto &buffer = chunks[chunk];
+
+	std::memcpy((int8_t *) buffer.mapped + cursor, data, size);
+
+	size_t offset = cursor;
+	cursor += size;
+
+	return { chunk, offset };
+}
+
+void StagingUploader::upload(const Buffer &buffer, const void *data, size_t size, size_t offset)
+{
+	howl_assert(offset + size <= buffer.size, "staged upload exceeds the destination buffer");
+	howl_assert(buffer.shared || transfer_on_graphics(device),
+		"staged uploads need buffers shared with the transfer queue");
+
+	auto [index, source] = stage(data, size);
+
+	auto region = vk::BufferCopy()
+		.setSrcOffset(source)
+		.setDstOffset(offset)
+		.setSize(size);
+
+	copies.push_back({ index, buffer.handle, region });
+}
+
+void StagingUploader::upload(const Image &image, const void *data, size_t size, const vk::ImageLayout &layout, uint32_t levels)
+{
+	howl_assert(levels == 1 || levels == image.mip_levels,
+		"uploading {} levels into an image with {}", levels, image.mip_levels);
+
+	// Buffer offsets must be a multiple of the texel block size
+	size_t alignment = std::lcm(size_t(16), size_t(vk::blockSize(image.format)));
+
+	auto [index, source] = stage(data, size, alignment);
+
+	std::vector <vk::BufferImageCopy> regions;
+
+	size_t offset = source;
+	for (uint32_t level = 0; level < levels; level++) {
+		auto extent = vk::Extent2D(
+			std::max(image.size.width >> level, 1u),
+			std::max(image.size.height >> level, 1u));
+
+		auto subresource = vk::ImageSubresourceLayers()
+			.setAspectMask(image.aspect)
+			.setBaseArrayLayer(0)
+			.setLayerCount(1)
+			.setMipLevel(level);
+
+		regions.push_back(vk::BufferImageCopy()
+			.setBufferOffset(offset)
+			.setImageOffset(vk::Offset3D(0, 0, 0))
+			.setImageSubresource(subresource)
+			.setImageExtent(vk::Extent3D(extent, 1)));
+
+		offset += Image::bytes(image.format, extent);
+	}
+
+	howl_assert(offset - source == size, "image upload of {} bytes, expected {}", size, offset - source);
+
+	bool generate = (levels < image.mip_levels);
+
+	// Generated chains are recorded on the graphics queue instead
+	howl_assert(generate || image.shared || transfer_on_graphics(device),
+		"staged uploads need images shared with the transfer queue");
+
+	image_copies.push_back({ index, image, layout, regions, generate });
+}
+
+void StagingUploader::record(const vk::CommandBuffer &cmd, const std::vector <ImageCopy> &batch) const
+{
+	if (batch.empty())
+		return;
+
+	// Every level moves into the transfer layout together
+	std::vector <vk::ImageMemoryBarrier> to_transfer;
+	std::vector <vk::ImageMemoryBarrier> to_final;
+
+	for (auto &copy : batch) {
+		auto range = vk::ImageSubresourceRange()
+			.setAspectMask(copy.image.aspect)
+			.setBaseArrayLayer(0)
+			.setBaseMipLevel(0)
+			.setLayerCount(1)
+			.setLevelCount(copy.image.mip_levels);
+
+		to_transfer.push_back(vk::ImageMemoryBarrier()
+			.setImage(copy.image.handle)
+			.setSrcAccessMask(vk::AccessFlagBits::eNone)
+			.setDstAccessMask(vk::AccessFlagBits::eTransferWrite)
+			.setOldLayout(vk::ImageLayout::eUndefined)
+			.setNewLayout(vk::ImageLayout::eTransferDstOptimal)
+			.setSubresourceRange(range));
+
+		if (copy.generate)
+			continue;
+
+		to_final.push_back(vk::ImageMemoryBarrier()
+			.setImage(copy.image.handle)
+			.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eNone)
+			.setOldLayout(vk::ImageLayout::eTransferDstOptimal)
+			.setNewLayout(copy.layout)
+			.setSubresourceRange(range));
+	}
+
+	cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
+		vk::PipelineStageFlagBits::eTransfer,
+		{ }, { }, { }, to_transfer);
+
+	for (auto &copy : batch) {
+		cmd.copyBufferToImage(chunks[copy.chunk].handle,
+			copy.image.handle,
+			vk::ImageLayout::eTransferDstOptimal,
+			copy.regions);
+	}
+
+	for (auto &copy : batch) {
+		if (copy.generate)
+			copy.image.generate_mips(device, cmd, copy.layout);
+	}
+
+	// Later queues synchronize through the timeline point
+	if (!to_final.empty()) {
+		cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eBottomOfPipe,
+			{ }, { }, { }, to_final);
+	}
+}
+
+std::vector <GpuDependency> StagingUploader::submit()
+{
+	if (copies.empty() && image_copies.empty())
+		return { };
+
+	// Blits need a graphics queue, plain copies do not
+	std::vector <ImageCopy> transfer_images;
+	std::vector <ImageCopy> graphics_images;
+
+	for (auto &copy : image_copies) {
+		if (copy.generate)
+			graphics_images.push_back(copy);
+		else
+			transfer_images.push_back(copy);
+	}
+
+	// Group regions by staging chunk and destination buffer
+	std::stable_sort(copies.begin(), copies.end(),
+		[](const Copy &a, const Copy &b) {
+			if (a.chunk != b.chunk)
+				return a.chunk < b.chunk;
+
+			return (VkBuffer) a.destination < (VkBuffer) b.destination;
+		});
+
+	auto begin_info = vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+
+	std::vector <GpuDependency> dependencies;
+
+	if (copies.size() || transfer_images.size()) {
+		cmd.reset();
+		cmd.begin(begin_info);
+
+		std::vector <vk::BufferCopy> regions;
+		for (size_t i = 0; i < copies.size(); i++) {
+			auto &copy = copies[i];
+
+			regions.push_back(copy.region);
+
+			bool last = (i + 1 == copies.size())
+				|| (copies[i + 1].chunk != copy.chunk)
+				|| (copies[i + 1].destination != copy.destination);
+
+			if (last) {
+				cmd.copyBuffer(chunks[copy.chunk].handle, copy.destination, regions);
+				regions.clear();
+			}
+		}
+
+		record(cmd, transfer_images);
+
+		// Make the uploads visible to any later work on the device
+		auto barrier = vk::MemoryBarrier()
+			.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eMemoryRead);
+
+		cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eAllCommands,
+			{ }, barrier, { }, { });
+
+		cmd.end();
+
+		point = timeline.submit({ cmd });
+		dependencies.push_back(timeline.at(point));
+	}
+
+	if (graphics_images.size()) {
+		graphics_cmd.reset();
+		graphics_cmd.begin(begin_info);
+		record(graphics_cmd, graphics_images);
+		graphics_cmd.end();
+
+		graphics_point = graphics_timeline.submit({ graphics_cmd });
+		dependencies.push_back(graphics_timeline.at(graphics_point));
+	}
+
+	howl_info("submitted {} staged copies ({} staging chunks, {} mipmapped images)",
+		copies.size() + image_copies.size(), chunk + 1, graphics_images.size());
+
+	copies.clear();
+	image_copies.clear();
+	pending = true;
+
+	return dependencies;
+}
+
+void StagingUploader::wait()
+{
+	if (!pending)
+		return;
+
+	// Points already reached return immediately
+	timeline.wait(device, point);
+	graphics_timeline.wait(device, graphics_point);
+
+	pending = false;
+	chunk = 0;
+	cursor = 0;
+}
+
+bool StagingUploader::ready() const
+{
+	if (!pending)
+		return true;
+
+	return timeline.reached(device, point)
+		&& graphics_timeline.reached(device, graphics_point);
+}
+
+void StagingUploader::destroy()
+{
+	wait();
+
+	for (auto &buffer : chunks)
+		buffer.destroy(device);
+
+	chunks.clear();
+
+	device.freeCommandBuffers(command_pool, cmd);
+	device.freeCommandBuffers(graphics_pool, graphics_cmd);
+	device.destroyCommandPool(graphics_pool);
+}
+
+} // namespace oak
@@ -0,0 +1,527 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+
+#include <vulkan/vulkan_format_traits.hpp>
+
+#include <howler/howler.hpp>
+
+#include "ktx2.hpp"
+#include "texture-loader.hpp"
+
+namespace oak {
+
+static std::vector <uint8_t> read_file(const std::filesystem::path &path)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file)
+		return { };
+
+	std::vector <uint8_t> bytes(file.tellg());
+
+	file.seekg(0);
+	file.read((char *) bytes.data(), bytes.size());
+
+	return bytes;
+}
+
+// 64-bit FNV-1a
+static uint64_t content_hash(const std::vector <uint8_t> &bytes)
+{
+	uint64_t hash = 0xCBF29CE484222325ull;
+
+	for (uint8_t byte : bytes) {
+		hash ^= byte;
+		hash *= 0x100000001B3ull;
+	}
+
+	return hash;
+}
+
+// Block compressed textures cannot be blitted, so they keep the levels
+// they came with; others get a full chain generated from the base level
+static uint32_t chain_levels(const Texture &texture)
+{
+	bool compressed = vk::blockExtent(texture.format)[0] > 1;
+	if (compressed || texture.mip_levels > 1)
+		return texture.mip_levels;
+
+	return std::bit_width(std::max(texture.width, texture.height));
+}
+
+// Formats whose texels can be averaged a byte at a time
+static bool filterable(const vk::Format &format)
+{
+	if (vk::blockExtent(format)[0] > 1 || vk::packed(format))
+		return false;
+
+	uint32_t components = vk::componentCount(format);
+	for (uint32_t i = 0; i < components; i++) {
+		if (vk::componentBits(format, i) != 8)
+			return false;
+	}
+
+	return vk::blockSize(format) == components;
+}
+
+// Drops the given number of levels from the top of the chain; with only
+// the base level stored, it is box filtered down instead
+static Texture trim(Texture texture, uint32_t count)
+{
+	if (count == 0)
+		return texture;
+
+	auto extent = vk::Extent2D(texture.width, texture.height);
+
+	if (texture.mip_levels > 1) {
+		size_t offset = Image::bytes(texture.format, extent, 0, count);
+
+		texture.data.erase(texture.data.begin(), texture.data.begin() + offset);
+		texture.mip_levels -= count;
+	} else {
+		uint32_t texel = vk::blockSize(texture.format);
+
+		for (uint32_t level = 0; level < count; level++) {
+			uint32_t width = std::max(extent.width >> 1, 1u);
+			uint32_t height = std::max(extent.height >> 1, 1u);
+
+			std::vector <uint8_t> data(size_t(width) * height * texel);
+
+			auto at = [&](uint32_t x, uint32_t y, uint32_t c) -> uint32_t {
+				x = std::min(x, extent.width - 1);
+				y = std::min(y, extent.height - 1);
+				return texture.data[(size_t(y) * extent.width + x) * texel + c];
+			};
+
+			for (uint32_t y = 0; y < height; y++) {
+				for (uint32_t x = 0; x < width; x++) {
+					for (uint32_t c = 0; c < texel; c++) {
+						uint32_t sum = at(2 * x, 2 * y, c)
+							+ at(2 * x + 1, 2 * y, c)
+							+ at(2 * x, 2 * y + 1, c)
+							+ at(2 * x + 1, 2 * y + 1, c);
+
+						data[(size_t(y) * width + x) * texel + c] = (sum + 2) / 4;
+					}
+				}
+			}
+
+			texture.data = std::move(data);
+			extent = vk::Extent2D(width, height);
+		}
+	}
+
+	texture.width = std::max(texture.width >> count, 1u);
+	texture.height = std::max(texture.height >> count, 1u);
+
+	return texture;
+}
+
+TextureLoader::TextureLoader(const Device &device_,
+			     StagingUploader &uploader_,
+			     ThreadPool &pool_,
+			     const Decoder &decoder_)
+		: device(device_),
+		uploader(uploader_),
+		pool(pool_),
+		decoder(decoder_)
+{
+	auto info = ImageInfo()
+		.with_format(vk::Format::eR8G8B8A8Unorm)
+		.with_size(vk::Extent2D(1, 1))
+		.with_usage(vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst)
+		.with_aspect(vk::ImageAspectFlagBits::eColor)
+		.with_shared(true);
+
+	placeholder = Image::from(device, info);
+	device.name(placeholder.handle, "texture placeholder");
+
+	uint32_t white = 0xFFFFFFFF;
+	placeholder.upload(device, uploader, &white, sizeof(white));
+}
+
+TextureLoader::Decoded TextureLoader::decode(const std::filesystem::path &path, Handle handle, uint32_t base, bool first)
+{
+	auto bytes = read_file(path);
+	if (bytes.empty()) {
+		howl_error("failed to read texture {}", path.string());
+		return { };
+	}
+
+	// Streaming decodes a file already known to be unique
+	if (first) {
+		uint64_t hash = content_hash(bytes);
+
+		std::vector <Known> candidates;
+
+		{
+			std::lock_guard lock(mutex);
+
+			auto [begin, end] = hashes.equal_range(hash);
+			for (auto it = begin; it != end; it++) {
+				if (it->second.size == bytes.size())
+					candidates.push_back(it->second);
+			}
+
+			if (candidates.empty())
+				hashes.emplace(hash, Known { bytes.size(), path, handle });
+		}
+
+		// Files are compared whole, so colliding hashes stay apart
+		for (auto &known : candidates) {
+			if (read_file(known.path) == bytes) {
+				Decoded result;
+				result.duplicate = known.handle;
+				return result;
+			}
+		}
+
+		if (!candidates.empty()) {
+			std::lock_guard lock(mutex);
+			hashes.emplace(hash, Known { bytes.size(), path, handle });
+		}
+	}
+
+	bool ktx2 = bytes.size() >= sizeof(KTX2::identifier)
+		&& !std::memcmp(bytes.data(), KTX2::identifier, sizeof(KTX2::identifier));
+
+	std::optional <Texture> texture;
+
+	if (ktx2) {
+		texture = KTX2::load(device, bytes, path);
+	} else if (decoder) {
+		texture = decoder(bytes);
+		if (!texture.has_value())
+			howl_error("failed to decode texture {}", path.string());
+	} else {
+		howl_error("no decoder for texture {}", path.string());
+	}
+
+	if (!texture.has_value())
+		return { };
+
+	Decoded result;
+	result.extent = vk::Extent2D(texture->width, texture->height);
+	result.levels = chain_levels(*texture);
+	result.streamable = (texture->mip_levels > 1) || filterable(texture->format);
+	result.base = result.streamable ? std::min(base, result.levels - 1) : 0;
+	result.texture = trim(std::move(*texture), result.base);
+
+	return result;
+}
+
+void TextureLoader::start(Handle handle)
+{
+	auto &entry = entries[handle];
+
+	bool first = (entry.levels == 0);
+
+	// Workers only touch the hash table, never the entries
+	entry.future = pool.submit([this, path = entry.path, handle, base = entry.target, first]() {
+		return decode(path, handle, base, first);
+	});
+}
+
+void TextureLoader::retire(const Image &image)
+{
+	retired.emplace_back(polls, image);
+}
+
+TextureLoader::Handle TextureLoader::request(const std::filesystem::path &path)
+{
+	auto key = std::filesystem::weakly_canonical(path);
+	if (paths.count(key))
+		return paths.at(key);
+
+	Handle handle = entries.size();
+
+	Entry entry;
+	entry.path = key;
+
+	entries.push_back(std::move(entry));
+	paths.emplace(key, handle);
+
+	start(handle);
+
+	return handle;
+}
+
+std::vector <TextureLoader::Handle> TextureLoader::poll()
+{
+	polls++;
+
+	// Frames that could sample these have retired by now
+	std::erase_if(retired, [&](std::pair <uint64_t, Image> &pair) {
+		if (polls < pair.first + latency)
+			return false;
+
+		pair.second.destroy(device);
+		return true;
+	});
+
+	std::vector <Handle> changed;
+
+	// Staging would otherwise block on the submission in flight
+	bool ready = uploader.ready();
+
+	if (ready) {
+		uploader.wait();
+
+		for (Handle handle : uploading) {
+			auto &entry = entries[handle];
+			if (entry.state == State::eResident)
+				retire(entry.image);
+
+			entry.image = entry.incoming;
+			entry.base = entry.incoming_base;
+			entry.incoming = Image();
+			entry.state = State::eResident;
+
+			changed.push_back(handle);
+		}
+
+		uploading.clear();
+	}
+
+	// Evictions and decodes towards each target
+	for (Handle handle = 0; handle < entries.size(); handle++) {
+		auto &entry = entries[handle];
+		if (entry.state == State::eDuplicate || entry.state == State::eFailed)
+			continue;
+
+		bool busy = entry.future.valid() || entry.texture.has_value() || entry.incoming.handle;
+		if (busy)
+			continue;
+
+		if (entry.target >= entry.levels) {
+			if (entry.state == State::eResident) {
+				retire(entry.image);
+
+				entry.image = Image();
+				entry.base = entry.levels;
+				entry.state = State::ePending;
+
+				changed.push_back(handle);
+			}
+
+			continue;
+		}
+
+		if (entry.state != State::eResident || entry.target != entry.base)
+			start(handle);
+	}
+
+	// Everything staged in this poll goes out in one submission; textures
+	// collected below wait for the next poll, so that a target set in the
+	// meantime can still drop their finer levels before they are uploaded
+	size_t staged = 0;
+	size_t count = 0;
+
+	for (Handle handle = 0; ready && handle < entries.size(); handle++) {
+		auto &entry = entries[handle];
+		if (!entry.texture.has_value())
+			continue;
+
+		// Evicted before it was ever uploaded
+		if (entry.target >= entry.levels) {
+			entry.texture.reset();
+			continue;
+		}
+
+		if (entry.streamable && entry.target > entry.incoming_base) {
+			uint32_t drop = entry.target - entry.incoming_base;
+
+			Decoded trimmed;
+			trimmed.extent = entry.extent;
+			trimmed.levels = entry.levels;
+			trimmed.base = entry.target;
+			trimmed.streamable = true;
+
+			entry.future = pool.submit([trimmed, drop, texture = std::move(*entry.texture)]() mutable {
+				trimmed.texture = trim(std::move(texture), drop);
+				return trimmed;
+			});
+
+			entry.texture.reset();
+			continue;
+		}
+
+		auto &texture = entry.texture.value();
+		if (staged && staged + texture.data.size() > batch_size)
+			break;
+
+		auto info = ImageInfo()
+			.with_format(texture.format)
+			.with_size(vk::Extent2D(texture.width, texture.height))
+			.with_usage(vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst)
+			.with_aspect(vk::ImageAspectFlagBits::eColor)
+			.with_shared(true)
+			.with_mip_levels(entry.levels - entry.incoming_base);
+
+		entry.incoming = Image::from(device, info);
+		device.name(entry.incoming.handle, entry.path.filename().string());
+
+		entry.incoming.upload(device, uploader, texture);
+
+		staged += texture.data.size();
+		count++;
+
+		// Staged on upload, so the host copy is no longer needed
+		entry.texture.reset();
+
+		uploading.push_back(handle);
+	}
+
+	if (count)
+		uploader.submit();
+
+	// Collect finished workers
+	for (Handle handle = 0; handle < entries.size(); handle++) {
+		auto &entry = entries[handle];
+		if (!entry.future.valid())
+			continue;
+
+		if (entry.future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			continue;
+
+		auto decoded = entry.future.get();
+
+		if (decoded.duplicate.has_value()) {
+			entry.state = State::eDuplicate;
+			entry.duplicate = decoded.duplicate;
+
+			howl_info("texture {} has the same contents as {}",
+				entry.path.string(), entries[resolve(handle)].path.string());
+
+			changed.push_back(handle);
+		} else if (decoded.texture.has_value()) {
+			entry.format = decoded.texture->format;
+			entry.extent = decoded.extent;
+			entry.levels = decoded.levels;
+			entry.streamable = decoded.streamable;
+
+			entry.texture = std::move(decoded.texture);
+			entry.incoming_base = decoded.base;
+		} else if (entry.levels == 0) {
+			entry.state = State::eFailed;
+		} else {
+			// Keep what is resident rather than retrying every poll
+			entry.target = (entry.state == State::eResident) ? entry.base : entry.levels;
+		}
+	}
+
+	// Duplicates change along with the image they share
+	std::vector <Handle> result;
+
+	for (Handle handle = 0; handle < entries.size(); handle++) {
+		bool hit = std::find(changed.begin(), changed.end(), handle) != changed.end()
+			|| std::find(changed.begin(), changed.end(), resolve(handle)) != changed.end();
+
+		if (hit)
+			result.push_back(handle);
+	}
+
+	return result;
+}
+
+void TextureLoader::stream(Handle handle, uint32_t base)
+{
+	auto &entry = entries[resolve(handle)];
+	if (entry.levels == 0 || entry.state == State::eFailed)
+		return;
+
+	if (base < entry.levels && !entry.streamable)
+		base = 0;
+
+	entry.target = std::min(base, entry.levels);
+}
+
+TextureLoader::Handle TextureLoader::resolve(Handle handle) const
+{
+	while (entries[handle].state == State::eDuplicate)
+		handle = entries[handle].duplicate.value();
+
+	return handle;
+}
+
+bool TextureLoader::resident(Handle handle) const
+{
+	return entries[resolve(handle)].state == State::eResident;
+}
+
+bool TextureLoader::failed(Handle handle) const
+{
+	return entries[resolve(handle)].state == State::eFailed;
+}
+
+bool TextureLoader::idle() const
+{
+	for (auto &entry : entries) {
+		if (entry.future.valid() || entry.texture.has_value() || entry.incoming.handle)
+			return false;
+	}
+
+	return true;
+}
+
+size_t TextureLoader::bytes(Handle handle) const
+{
+	auto &entry = entries[resolve(handle)];
+
+	size_t result = 0;
+	if (entry.state == State::eResident)
+		result += entry.image.footprint();
+	if (entry.incoming.handle)
+		result += entry.incoming.footprint();
+
+	return result;
+}
+
+size_t TextureLoader::bytes(Handle handle, uint32_t base) const
+{
+	auto &entry = entries[resolve(handle)];
+	if (base >= entry.levels)
+		return 0;
+
+	return Image::bytes(entry.format, entry.extent, base, entry.levels - base);
+}
+
+const Image &TextureLoader::image(Handle handle) const
+{
+	auto &entry = entries[resolve(handle)];
+	if (entry.state == State::eResident)
+		return entry.image;
+
+	return placeholder;
+}
+
+void TextureLoader::destroy()
+{
+	for (auto &entry : entries) {
+		if (entry.future.valid())
+			entry.future.wait();
+	}
+
+	uploader.wait();
+
+	for (auto &entry : entries) {
+		if (entry.image.handle)
+			entry.image.destroy(device);
+		if (entry.incoming.handle)
+			entry.incoming.destroy(device);
+	}
+
+	for (auto &[stamp, image] : retired)
+		image.destroy(device);
+
+	placeholder.destroy(device);
+
+	entries.clear();
+	paths.clear();
+	hashes.clear();
+	uploading.clear();
+	retired.clear();
+}
+
+} // namespace oak
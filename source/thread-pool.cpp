@@ -0,0 +1,42 @@
+#include "thread-pool.hpp"
+
+namespace oak {
+
+ThreadPool::ThreadPool(size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		workers.emplace_back([this]() {
+			while (true) {
+				std::function <void ()> task;
+
+				{
+					std::unique_lock lock(mutex);
+					condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+
+					if (tasks.empty())
+						return;
+
+					task = std::move(tasks.front());
+					tasks.pop();
+				}
+
+				task();
+			}
+		});
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard lock(mutex);
+		stopping = true;
+	}
+
+	condition.notify_all();
+
+	for (auto &worker : workers)
+		worker.join();
+}
+
+} // namespace oak
@@ -0,0 +1,111 @@
+#include <howler/howler.hpp>
+
+#include "timeline.hpp"
+
+namespace oak {
+
+uint64_t GpuTimeline::submitted() const
+{
+	std::lock_guard lock(counter->mutex);
+	return counter->submitted;
+}
+
+uint64_t GpuTimeline::completed(const Device &device) const
+{
+	return device.getSemaphoreCounterValue(semaphore);
+}
+
+bool GpuTimeline::reached(const Device &device, uint64_t point) const
+{
+	return completed(device) >= point;
+}
+
+bool GpuTimeline::wait(const Device &device, uint64_t point, uint64_t timeout) const
+{
+	auto wait_info = vk::SemaphoreWaitInfo()
+		.setSemaphores(semaphore)
+		.setValues(point);
+
+	auto wait_result = device.waitSemaphores(wait_info, timeout);
+	howl_assert(wait_result == vk::Result::eSuccess || wait_result == vk::Result::eTimeout,
+		"failed to wait for timeline point {}", point);
+
+	return wait_result == vk::Result::eSuccess;
+}
+
+void GpuTimeline::drain(const Device &device) const
+{
+	wait(device, submitted());
+}
+
+GpuDependency GpuTimeline::at(uint64_t point, const vk::PipelineStageFlags &stage) const
+{
+	return { semaphore, point, stage };
+}
+
+uint64_t GpuTimeline::submit(const std::vector <vk::CommandBuffer> &commands,
+			     const std::vector <GpuDependency> &dependencies,
+			     const std::vector <vk::Semaphore> &signal) const
+{
+	std::vector <vk::Semaphore> wait_semaphores;
+	std::vector <uint64_t> wait_values;
+	std::vector <vk::PipelineStageFlags> wait_stages;
+
+	for (auto &dependency : dependencies) {
+		wait_semaphores.push_back(dependency.semaphore);
+		wait_values.push_back(dependency.value);
+		wait_stages.push_back(dependency.stage);
+	}
+
+	// The timeline point goes first, binary semaphores ignore their values
+	std::vector <vk::Semaphore> signal_semaphores { semaphore };
+	signal_semaphores.insert(signal_semaphores.end(), signal.begin(), signal.end());
+
+	std::vector <uint64_t> signal_values(signal_semaphores.size(), 0);
+
+	// Points must be signaled in submission order
+	std::lock_guard lock(counter->mutex);
+
+	uint64_t point = counter->submitted + 1;
+	signal_values[0] = point;
+
+	auto timeline_info = vk::TimelineSemaphoreSubmitInfo()
+		.setWaitSemaphoreValues(wait_values)
+		.setSignalSemaphoreValues(signal_values);
+
+	auto submit_info = vk::SubmitInfo()
+		.setCommandBuffers(commands)
+		.setWaitSemaphores(wait_semaphores)
+		.setWaitDstStageMask(wait_stages)
+		.setSignalSemaphores(signal_semaphores)
+		.setPNext(&timeline_info);
+
+	auto guard = queue.acquire();
+	queue.vk::Queue::submit(submit_info);
+
+	counter->submitted = point;
+
+	return point;
+}
+
+void GpuTimeline::destroy(const Device &device) const
+{
+	device.destroySemaphore(semaphore);
+}
+
+GpuTimeline GpuTimeline::from(const Device &device, const Queue &queue)
+{
+	GpuTimeline result;
+
+	auto type_info = vk::SemaphoreTypeCreateInfo()
+		.setSemaphoreType(vk::SemaphoreType::eTimeline)
+		.setInitialValue(0);
+
+	result.queue = queue;
+	result.semaphore = device.createSemaphore(vk::SemaphoreCreateInfo().setPNext(&type_info));
+	result.counter = std::make_shared <Counter> ();
+
+	return result;
+}
+
+} // namespace oak
@@ -0,0 +1,78 @@
+#include <howler/howler.hpp>
+
+#include "transient.hpp"
+
+namespace oak {
+
+TransientAllocation TransientRing::allocate(size_t size, size_t align)
+{
+	align = std::max(align, alignment);
+
+	size_t offset = (cursor + align - 1) & ~(align - 1);
+
+	howl_assert(offset + size <= partition,
+		"transient ring partition exhausted ({} + {} > {} bytes)",
+		offset, size, partition);
+
+	cursor = offset + size;
+
+	size_t absolute = frame * partition + offset;
+
+	TransientAllocation result;
+	result.buffer = buffer.handle;
+	result.offset = absolute;
+	result.size = size;
+	result.pointer = (int8_t *) buffer.mapped + absolute;
+
+	return result;
+}
+
+void TransientRing::reclaim(uint32_t frame_)
+{
+	frame = frame_ % frames;
+	cursor = 0;
+}
+
+void TransientRing::flush(const Device &device) const
+{
+	if (cursor > 0)
+		buffer.flush(device, frame * partition, cursor);
+}
+
+void TransientRing::destroy(const Device &device) const
+{
+	buffer.destroy(device);
+}
+
+TransientRing TransientRing::from(const Device &device, size_t frames, size_t partition, const vk::BufferUsageFlags &usage)
+{
+	auto &limits = device.properties.limits;
+
+	TransientRing result;
+
+	// Satisfy every descriptor type the ring can be bound as
+	result.alignment = std::max({
+		size_t(16),
+		size_t(limits.minUniformBufferOffsetAlignment),
+		size_t(limits.minStorageBufferOffsetAlignment),
+		size_t(limits.nonCoherentAtomSize)
+	});
+
+	result.frames = frames;
+	result.partition = (partition + result.alignment - 1) & ~(result.alignment - 1);
+
+	// Prefer device local host memory (ReBAR) when the heap has room
+	result.buffer = Buffer::from(device,
+		frames * result.partition,
+		usage,
+		vk::MemoryPropertyFlagBits::eHostVisible
+		| vk::MemoryPropertyFlagBits::eHostCoherent,
+		vk::MemoryPropertyFlagBits::eDeviceLocal);
+	result.buffer.persist(device);
+
+	device.name(result.buffer, "transient ring");
+
+	return result;
+}
+
+} // namespace oak
@@ -2,6 +2,8 @@
 
 #include "util.hpp"
 #include "sync.hpp"
+#include "readback.hpp"
+#include "transient.hpp"
 
 namespace oak {
 
@@ -10,7 +12,9 @@ void primary_render_loop(const Device &device,
 			 Window &window,
 			 const Renderer &render,
 			 const std::optional <Resizer> &resize,
-			 const std::optional <AfterPresent> &after_present)
+			 const std::optional <AfterPresent> &after_present,
+			 TransientRing *transient,
+			 ReadbackRing *readback)
 {
 	auto command_buffer_info = vk::CommandBufferAllocateInfo()
 		.setCommandPool(resources.command_pool)
@@ -19,22 +23,39 @@ void primary_render_loop(const Device &device,
 
 	auto commands = device.allocateCommandBuffers(command_buffer_info);
 
-	auto sync = PrimarySynchronization::from(device, window.images.size());
+	auto sync = PrimarySynchronization::from(device, resources.queue, window.images.size());
+
+	if (transient) {
+		howl_assert(transient->frames == window.images.size(),
+			"transient ring has {} partitions, expected {}",
+			transient->frames, window.images.size());
+	}
+
+	if (readback) {
+		howl_assert(readback->frames == window.images.size(),
+			"readback ring has {} partitions, expected {}",
+			readback->frames, window.images.size());
+	}
 
 	uint32_t frame = 0;
 
 	SwapchainStatus status;
 	uint32_t image_index;
-	bool skip_reset = false;
 
 	while (!glfwWindowShouldClose(window.glfw)) {
 		glfwPollEvents();
 
-		// In case acquire failed in the previous frame
-		if (skip_reset)
-			skip_reset = false;
-		else
-			device.waitAndReset(sync.processing[frame]);
+		// Waiting again after a failed acquire returns immediately
+		sync.timeline.wait(device, sync.points[frame]);
+
+		// The frame's previous submission has retired
+		if (transient)
+			transient->reclaim(frame);
+
+		// Only this loop submits on its timeline, so the
+		// frame's submission will signal the next point
+		if (readback)
+			readback->reclaim(frame, sync.timeline, sync.timeline.submitted() + 1);
 
 		std::tie(status, image_index) = device.acquireNextImage(window.swapchain, sync.available[frame]);
 
@@ -48,7 +69,6 @@ void primary_render_loop(const Device &device,
 			if (resize)
 				resize.value()();
 
-			skip_reset = true;
 			continue;
 		} else if (status == eFaulty) {
 			howl_error("failed to present swapchain");
@@ -63,12 +83,16 @@ void primary_render_loop(const Device &device,
 		}
 		cmd.end();
 
+		if (transient)
+			transient->flush(device);
+
 		// Submit and present
-		resources.queue.submit({ cmd },
-			{ sync.available[frame] },
-			{ sync.finished[frame] },
-			sync.processing[frame],
-			vk::PipelineStageFlagBits::eColorAttachmentOutput);
+		auto acquired = GpuDependency {
+			sync.available[frame], 0,
+			vk::PipelineStageFlagBits::eColorAttachmentOutput
+		};
+
+		sync.points[frame] = sync.timeline.submit({ cmd }, { acquired }, { sync.finished[frame] });
 
 		status = resources.queue.present(window.swapchain, { sync.finished[frame] }, image_index);
 
@@ -105,13 +129,15 @@ void transition(const vk::CommandBuffer &cmd,
 		const vk::AccessFlags &source_access,
 		const vk::AccessFlags &destination_access,
 		const vk::PipelineStageFlags &source_stage,
-		const vk::PipelineStageFlags &destination_stage)
+		const vk::PipelineStageFlags &destination_stage,
+		uint32_t base_level,
+		uint32_t level_count)
 {
 	auto range = vk::ImageSubresourceRange()
 		.setAspectMask(aspect)
 		.setBaseArrayLayer(0)
-		.setBaseMipLevel(0)
-		.setLevelCount(1)
+		.setBaseMipLevel(base_level)
+		.setLevelCount(level_count)
 		.setLayerCount(1);
 
 	auto image_barrier = vk::ImageMemoryBarrier()